@@ -0,0 +1,301 @@
+#include "BufferPool.h"
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+///////////////////  Replacement policies  ///////////////////
+
+/*
+ * Keeps frames in an intrusive doubly linked list ordered by load time
+ * (LAST_LOADED) or by last access (LRU). The head is the newest entry.
+ * The links are frame numbers, so loading a page never allocates.
+ */
+class ListPolicy : public ReplacementPolicy {
+ public:
+  ListPolicy(unsigned num_frames, bool move_on_access) :
+    next(num_frames, -1), prev(num_frames, -1), present(num_frames, false),
+    head(-1), tail(-1), touch(move_on_access) {}
+
+  void loaded(int frame) {
+    present[frame] = true;
+    pushFront(frame);
+  }
+
+  void accessed(int frame) {
+    if (touch && present[frame] && head != frame) {
+      unlink(frame);
+      pushFront(frame);
+    }
+  }
+
+  void removed(int frame) {
+    if (!present[frame])
+      return;
+    unlink(frame);
+    present[frame] = false;
+  }
+
+  int victim(const function<bool(int)>& evictable) {
+    //LAST_LOADED gives up the newest page, LRU the least recently used one.
+    int frame = touch ? tail : head;
+    while (frame != -1 && !evictable(frame))
+      frame = touch ? prev[frame] : next[frame];
+    return frame;
+  }
+
+ private:
+  vector<int> next;
+  vector<int> prev;
+  vector<bool> present;
+  int head;
+  int tail;
+  bool touch;
+
+  void pushFront(int frame) {
+    prev[frame] = -1;
+    next[frame] = head;
+    if (head != -1)
+      prev[head] = frame;
+    else
+      tail = frame;
+    head = frame;
+  }
+
+  void unlink(int frame) {
+    if (prev[frame] != -1)
+      next[prev[frame]] = next[frame];
+    else
+      head = next[frame];
+    if (next[frame] != -1)
+      prev[next[frame]] = prev[frame];
+    else
+      tail = prev[frame];
+  }
+};
+
+/*
+ * Second-chance clock: a hit sets the reference bit, the hand clears
+ * bits until it finds a frame whose bit is already clear.
+ */
+class ClockPolicy : public ReplacementPolicy {
+ public:
+  ClockPolicy(unsigned num_frames) :
+    referenced(num_frames, false), present(num_frames, false), hand(0) {}
+
+  void loaded(int frame) {
+    present[frame] = true;
+    referenced[frame] = true;
+  }
+
+  void accessed(int frame) {referenced[frame] = true;}
+
+  void removed(int frame) {
+    present[frame] = false;
+    referenced[frame] = false;
+  }
+
+  int victim(const function<bool(int)>& evictable) {
+    //two turns clear every bit, so a third finds nothing new
+    for (size_t n = 0; n < 2 * present.size() + 1; ++n) {
+      unsigned frame = hand;
+      hand = (hand + 1) % present.size();
+      if (!present[frame] || !evictable(frame))
+        continue;
+      if (!referenced[frame])
+        return frame;
+      referenced[frame] = false;
+    }
+    return -1;
+  }
+
+ private:
+  vector<bool> referenced;
+  vector<bool> present;
+  unsigned hand;
+};
+
+/*
+ * LRU-2: evicts the frame whose second most recent access is the oldest.
+ * Frames touched only once since they were loaded go first, oldest load
+ * first, so a single scan cannot push out the pages that are reused.
+ */
+class LRUKPolicy : public ReplacementPolicy {
+ public:
+  LRUKPolicy(unsigned num_frames) :
+    last(num_frames, 0), prev(num_frames, 0), present(num_frames, false), clock(0) {}
+
+  void loaded(int frame) {
+    present[frame] = true;
+    last[frame] = ++clock;
+    prev[frame] = 0;
+  }
+
+  void accessed(int frame) {
+    prev[frame] = last[frame];
+    last[frame] = ++clock;
+  }
+
+  void removed(int frame) {present[frame] = false;}
+
+  int victim(const function<bool(int)>& evictable) {
+    int best = -1;
+    for (unsigned i = 0; i < present.size(); ++i) {
+      if (!present[i] || !evictable(i))
+	continue;
+      if (best == -1 || prev[i] < prev[best] ||
+	  (prev[i] == prev[best] && last[i] < last[best]))
+	best = i;
+    }
+    return best;
+  }
+
+ private:
+  vector<unsigned long> last;
+  vector<unsigned long> prev; //0 means fewer than two accesses
+  vector<bool> present;
+  unsigned long clock;
+};
+
+ReplacementPolicy* ReplacementPolicy::create(ReplacementPolicyType type, unsigned num_frames) {
+  switch (type) {
+  case LRU:
+    return new ListPolicy(num_frames, true);
+  case CLOCK:
+    return new ClockPolicy(num_frames);
+  case LRU_K:
+    return new LRUKPolicy(num_frames);
+  case LAST_LOADED:
+  default:
+    return new ListPolicy(num_frames, false);
+  }
+}
+
+/////////////////// End Replacement policies  ///////////////////
+
+///////////////////  BufferPool  ///////////////////
+
+const int EMPTY_SLOT = -2147483647 - 1;
+
+BufferPool::BufferPool(unsigned num_frames, ReplacementPolicyType type) :
+  frames(num_frames), latches(new FrameLatch[num_frames]), arena(NULL), frame_size(0), page_capacity(0),
+  policy(ReplacementPolicy::create(type, num_frames)) {
+  //hand out low frame numbers first
+  free_frames.reserve(num_frames);
+  for (int i = (int)num_frames - 1; i >= 0; --i)
+    free_frames.push_back(i);
+
+  unsigned slots = 16;
+  while (slots < 2 * num_frames)
+    slots *= 2;
+  slot_page.assign(slots, EMPTY_SLOT);
+  slot_frame.assign(slots, -1);
+  slot_mask = slots - 1;
+}
+
+BufferPool::~BufferPool() {
+  delete[] latches;
+  free(arena);
+  delete policy;
+}
+
+void BufferPool::allocate(unsigned page_size) {
+  clear();
+  free(arena);
+  arena = NULL;
+  frame_size = (page_size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+  if (frame_size == 0)
+    frame_size = CACHE_LINE_SIZE;
+  //the padding is usable, so short pages have room to grow
+  page_capacity = frame_size;
+  void* mem = NULL;
+  if (posix_memalign(&mem, CACHE_LINE_SIZE, (size_t)frame_size * frames.size()) != 0)
+    throw std::bad_alloc();
+  arena = (char*)mem;
+}
+
+unsigned BufferPool::homeSlot(int page_id) {
+  unsigned h = (unsigned)page_id * 2654435761u;
+  return (h ^ (h >> 16)) & slot_mask;
+}
+
+/*
+ * Returns the slot holding page_id, or the empty slot where it
+ * would be inserted.
+ */
+unsigned BufferPool::slotFor(int page_id) {
+  unsigned i = homeSlot(page_id);
+  while (slot_page[i] != EMPTY_SLOT && slot_page[i] != page_id)
+    i = (i + 1) & slot_mask;
+  return i;
+}
+
+int BufferPool::lookup(int page_id) {
+  int i = slot_frame[slotFor(page_id)];
+  if (i == -1) {
+    ++stats.misses;
+    return -1;
+  }
+  ++stats.hits;
+  policy->accessed(i);
+  return i;
+}
+
+int BufferPool::peek(int page_id) {
+  return slot_frame[slotFor(page_id)];
+}
+
+int BufferPool::insert(int page_id) {
+  int i = free_frames.back();
+  free_frames.pop_back();
+  unsigned s = slotFor(page_id);
+  slot_page[s] = page_id;
+  slot_frame[s] = i;
+  frames[i] = Frame();
+  frames[i].page_id = page_id;
+  policy->loaded(i);
+  return i;
+}
+
+void BufferPool::evict(int frame) {
+  //Delete from the probe sequence by shifting later entries back,
+  //so lookups never have to skip tombstones.
+  unsigned hole = slotFor(frames[frame].page_id);
+  unsigned j = hole;
+  while (true) {
+    j = (j + 1) & slot_mask;
+    if (slot_page[j] == EMPTY_SLOT)
+      break;
+    unsigned home = homeSlot(slot_page[j]);
+    if (((j - home) & slot_mask) >= ((j - hole) & slot_mask)) {
+      slot_page[hole] = slot_page[j];
+      slot_frame[hole] = slot_frame[j];
+      hole = j;
+    }
+  }
+  slot_page[hole] = EMPTY_SLOT;
+  slot_frame[hole] = -1;
+
+  frames[frame] = Frame();
+  policy->removed(frame);
+  free_frames.push_back(frame);
+  ++stats.evictions;
+}
+
+int BufferPool::victim() {
+  return policy->victim([this](int i) { return frames[i].pins == 0; });
+}
+
+void BufferPool::clear() {
+  for (unsigned i = 0; i < frames.size(); ++i) {
+    if (frames[i].page_id == -1)
+      continue;
+    policy->removed(i);
+    free_frames.push_back(i);
+    frames[i] = Frame();
+  }
+  slot_page.assign(slot_page.size(), EMPTY_SLOT);
+  slot_frame.assign(slot_frame.size(), -1);
+}
+
+/////////////////// End BufferPool  ///////////////////
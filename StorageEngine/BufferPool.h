@@ -0,0 +1,198 @@
+#ifndef BUFFERPOOL_H_
+#define BUFFERPOOL_H_
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+#include <pthread.h>
+
+const unsigned CACHE_LINE_SIZE = 64;
+
+/*
+ * Which frame the buffer pool gives up when it is full.
+ * LAST_LOADED evicts the page that was read in most recently, which is
+ * what the original records vector did by evicting records.back(); it is
+ * the default so the reference outputs under correct/ stay reproducible.
+ */
+enum ReplacementPolicyType {LAST_LOADED, LRU, CLOCK, LRU_K};
+
+struct BufferPoolStats {
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+  unsigned long dirty_flushes;
+  unsigned long prefetches;   //pages read ahead on an I/O thread
+  unsigned long coalesced;    //dirty pages written along with an evicted one
+
+  BufferPoolStats() : hits(0), misses(0), evictions(0), dirty_flushes(0),
+    prefetches(0), coalesced(0) {}
+};
+
+/*
+ * Descriptor of one buffer frame. The page bytes live in the arena,
+ * not here, so scanning the descriptors never touches page data.
+ */
+struct Frame {
+  int page_id;
+  int pageLSN;
+  bool dirty;
+  unsigned length; //bytes of the frame holding page data
+  unsigned pins; //holders that keep the page in this frame
+  bool loading; //still being read in on an I/O thread
+  bool prefetched; //read ahead and not looked up since, holds a pin
+
+  Frame() : page_id(-1), pageLSN(-1), dirty(false), length(0), pins(0),
+    loading(false), prefetched(false) {}
+};
+
+/*
+ * Reader/writer latch on one buffer frame, held while the frame's page
+ * bytes or descriptor are read (shared) or changed (exclusive). A frame
+ * only changes pages under its exclusive latch, so a thread that holds
+ * the latch and finds the page it wanted in the frame keeps it.
+ */
+class FrameLatch {
+ public:
+  FrameLatch() {pthread_rwlock_init(&rw, NULL);}
+  ~FrameLatch() {pthread_rwlock_destroy(&rw);}
+
+  void lockShared() {pthread_rwlock_rdlock(&rw);}
+  void unlockShared() {pthread_rwlock_unlock(&rw);}
+  void lockExclusive() {pthread_rwlock_wrlock(&rw);}
+  void unlockExclusive() {pthread_rwlock_unlock(&rw);}
+
+ private:
+  pthread_rwlock_t rw;
+
+  FrameLatch(const FrameLatch&);
+  FrameLatch& operator=(const FrameLatch&);
+};
+
+///////////////////  ReplacementPolicy  ///////////////////
+
+class ReplacementPolicy {
+ public:
+  virtual ~ReplacementPolicy() {}
+
+  /*
+   * A page was just read into frame.
+   */
+  virtual void loaded(int frame) = 0;
+
+  /*
+   * A resident page in frame was looked up again.
+   */
+  virtual void accessed(int frame) = 0;
+
+  /*
+   * frame no longer holds a page.
+   */
+  virtual void removed(int frame) = 0;
+
+  /*
+   * Returns the occupied frame that should be evicted next among the
+   * ones evictable accepts, or -1 if it accepts none of them.
+   */
+  virtual int victim(const std::function<bool(int)>& evictable) = 0;
+
+  static ReplacementPolicy* create(ReplacementPolicyType type, unsigned num_frames);
+};
+
+/////////////////// End ReplacementPolicy  ///////////////////
+
+///////////////////  BufferPool  ///////////////////
+
+class BufferPool {
+ public:
+  BufferPool(unsigned num_frames, ReplacementPolicyType type);
+  ~BufferPool();
+
+  /*
+   * (Re)allocates the page arena so that every frame can hold at least
+   * page_size bytes. Frames are padded to a whole number of cache
+   * lines and the arena starts on a cache line boundary.
+   * Drops every resident page.
+   */
+  void allocate(unsigned page_size);
+
+  /*
+   * Returns the frame holding page_id, or -1 if it is not resident.
+   * Counts a hit or a miss and tells the policy about the access.
+   */
+  int lookup(int page_id);
+
+  /*
+   * Same as lookup, but does not touch the counters or the policy.
+   */
+  int peek(int page_id);
+
+  /*
+   * Maps page_id to a free frame and returns the frame.
+   * The caller must make room first if the pool is full.
+   */
+  int insert(int page_id);
+
+  /*
+   * Unmaps the page held in frame. Counts an eviction.
+   */
+  void evict(int frame);
+
+  /*
+   * Picks the frame to evict next, never a pinned one; -1 if every
+   * frame is pinned. The page stays resident until evict() is called
+   * on the frame.
+   */
+  int victim();
+
+  /*
+   * A pinned frame keeps its page: victim() passes it over. Pins
+   * count, so a frame can be pinned more than once. The caller
+   * serializes these with lookup and victim.
+   */
+  void pin(int i) {++frames[i].pins;}
+  void unpin(int i) {--frames[i].pins;}
+
+  bool full() {return free_frames.empty();}
+
+  /*
+   * Drops every page without counting evictions (used on a crash).
+   */
+  void clear();
+
+  Frame& frame(int i) {return frames[i];}
+  FrameLatch& latch(int i) {return latches[i];}
+  char* data(int i) {return arena + (size_t)i * frame_size;}
+  unsigned pageSize() {return page_capacity;}
+  unsigned size() {return frames.size();}
+
+  void countDirtyFlush() {++stats.dirty_flushes;}
+  void countPrefetch() {++stats.prefetches;}
+  void countCoalesced(unsigned pages) {stats.coalesced += pages;}
+  BufferPoolStats getStats() {return stats;}
+
+ private:
+  std::vector<Frame> frames;
+  FrameLatch* latches;
+  std::vector<int> free_frames;
+  char* arena;
+  unsigned frame_size;     //bytes between two frames in the arena
+  unsigned page_capacity;  //bytes of page data a frame can hold
+
+  //Open addressing page_id -> frame table with linear probing.
+  //Sized to at least twice the number of frames, so it never fills.
+  std::vector<int> slot_page;
+  std::vector<int> slot_frame;
+  unsigned slot_mask;
+  unsigned homeSlot(int page_id);
+  unsigned slotFor(int page_id);
+
+  ReplacementPolicy* policy;
+  BufferPoolStats stats;
+
+  BufferPool(const BufferPool&);
+  BufferPool& operator=(const BufferPool&);
+};
+
+/////////////////// End BufferPool  ///////////////////
+
+#endif
@@ -0,0 +1,28 @@
+#include "Checksum.h"
+
+namespace {
+
+struct CrcTable {
+  uint32_t entry[256];
+
+  CrcTable() {
+    for (uint32_t n = 0; n < 256; ++n) {
+      uint32_t c = n;
+      for (int k = 0; k < 8; ++k)
+	c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      entry[n] = c;
+    }
+  }
+};
+
+const CrcTable table;
+
+}
+
+uint32_t crc32(const void* buf, size_t len, uint32_t crc) {
+  const unsigned char* p = (const unsigned char*)buf;
+  crc = ~crc;
+  for (size_t i = 0; i < len; ++i)
+    crc = table.entry[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
@@ -0,0 +1,13 @@
+#ifndef CHECKSUM_H_
+#define CHECKSUM_H_
+
+#include <cstddef>
+#include <stdint.h>
+
+/*
+ * CRC-32 (IEEE 802.3, the one zlib uses) of len bytes at buf.
+ * Pass the previous result as crc to checksum data in pieces.
+ */
+uint32_t crc32(const void* buf, size_t len, uint32_t crc = 0);
+
+#endif
@@ -0,0 +1,116 @@
+#include "Compress.h"
+#include <cstring>
+#include <stdint.h>
+
+using namespace std;
+
+namespace {
+
+const size_t MIN_MATCH = 4;
+const size_t MAX_DISTANCE = 65535;
+const int HASH_BITS = 12;
+
+uint32_t load32(const unsigned char* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+void putLength(string& out, size_t n) {
+  for (; n >= 255; n -= 255)
+    out += (char)255;
+  out += (char)n;
+}
+
+/*
+ * One sequence: literals from lit, then a match of match_len bytes
+ * distance back (none if match_len is 0).
+ */
+void putSequence(string& out, const unsigned char* lit, size_t lit_len,
+		 size_t distance, size_t match_len) {
+  size_t m = match_len ? match_len - MIN_MATCH : 0;
+  out += (char)((lit_len < 15 ? lit_len : 15) << 4 | (m < 15 ? m : 15));
+  if (lit_len >= 15)
+    putLength(out, lit_len - 15);
+  out.append((const char*)lit, lit_len);
+  if (!match_len)
+    return;
+  out += (char)(distance & 0xff);
+  out += (char)(distance >> 8);
+  if (m >= 15)
+    putLength(out, m - 15);
+}
+
+bool getLength(const unsigned char*& p, const unsigned char* end, size_t& n) {
+  unsigned char b;
+  do {
+    if (p == end)
+      return false;
+    b = *p++;
+    n += b;
+  } while (b == 255);
+  return true;
+}
+
+}
+
+void lzCompress(const char* in, size_t len, string& out) {
+  const unsigned char* src = (const unsigned char*)in;
+  //position + 1 of the last place each hashed 4 bytes were seen
+  uint32_t table[1 << HASH_BITS];
+  memset(table, 0, sizeof(table));
+  size_t anchor = 0;
+  size_t i = 0;
+  while (i + MIN_MATCH <= len) {
+    uint32_t seq = load32(src + i);
+    uint32_t h = (seq * 2654435761u) >> (32 - HASH_BITS);
+    size_t candidate = table[h];
+    table[h] = i + 1;
+    if (!candidate || i - (candidate - 1) > MAX_DISTANCE || load32(src + candidate - 1) != seq) {
+      ++i;
+      continue;
+    }
+    size_t from = candidate - 1;
+    size_t n = MIN_MATCH;
+    while (i + n < len && src[from + n] == src[i + n])
+      ++n;
+    putSequence(out, src + anchor, i - anchor, i - from, n);
+    i += n;
+    anchor = i;
+  }
+  putSequence(out, src + anchor, len - anchor, 0, 0);
+}
+
+bool lzDecompress(const char* in, size_t len, char* out, size_t out_len) {
+  const unsigned char* p = (const unsigned char*)in;
+  const unsigned char* end = p + len;
+  unsigned char* dst = (unsigned char*)out;
+  size_t o = 0;
+  while (p < end) {
+    unsigned char token = *p++;
+    size_t lit = token >> 4;
+    if (lit == 15 && !getLength(p, end, lit))
+      return false;
+    if (lit > (size_t)(end - p) || lit > out_len - o)
+      return false;
+    memcpy(dst + o, p, lit);
+    p += lit;
+    o += lit;
+    if (p == end)
+      break;
+    if (end - p < 2)
+      return false;
+    size_t distance = p[0] | p[1] << 8;
+    p += 2;
+    size_t n = token & 15;
+    if (n == 15 && !getLength(p, end, n))
+      return false;
+    n += MIN_MATCH;
+    if (distance == 0 || distance > o || n > out_len - o)
+      return false;
+    //the match may overlap what it produces
+    for (size_t k = 0; k < n; ++k, ++o)
+      dst[o] = dst[o - distance];
+  }
+  return o == out_len;
+}
@@ -0,0 +1,30 @@
+#ifndef COMPRESS_H_
+#define COMPRESS_H_
+
+#include <cstddef>
+#include <string>
+
+/*
+ * A small LZ77 block codec in the spirit of LZ4, for log buffers.
+ *
+ * A block is a series of sequences. Each starts with a token byte:
+ * the high nibble is the number of literals, the low nibble the match
+ * length minus 4. A nibble of 15 is continued by bytes that are added
+ * to it until one is not 255. The literals follow the token, then a
+ * 16-bit little endian distance back into the output and the rest of
+ * the match length. The last sequence is literals only.
+ */
+
+/*
+ * Appends the compressed form of len bytes at in to out.
+ */
+void lzCompress(const char* in, size_t len, std::string& out);
+
+/*
+ * Decompresses the block of len bytes at in into exactly out_len
+ * bytes at out. Returns false if the block is corrupt or does not
+ * decompress to out_len bytes; out may be partly written then.
+ */
+bool lzDecompress(const char* in, size_t len, char* out, size_t out_len);
+
+#endif
@@ -0,0 +1,53 @@
+#include "IOPool.h"
+
+using namespace std;
+
+void IOPool::setThreads(unsigned threads) {
+  if (threads == workers.size())
+    return;
+  {
+    lock_guard<mutex> queue(queue_mutex);
+    stopping = true;
+  }
+  work.notify_all();
+  for (unsigned i = 0; i < workers.size(); ++i)
+    workers[i].join();
+  workers.clear();
+  stopping = false;
+  for (unsigned i = 0; i < threads; ++i)
+    workers.push_back(thread(&IOPool::run, this));
+}
+
+void IOPool::submit(function<void()> job) {
+  if (workers.empty())
+    return;
+  {
+    lock_guard<mutex> queue(queue_mutex);
+    jobs.push_back(move(job));
+  }
+  work.notify_one();
+}
+
+void IOPool::drain() {
+  unique_lock<mutex> queue(queue_mutex);
+  idle.wait(queue, [this]{ return jobs.empty() && running == 0; });
+}
+
+void IOPool::run() {
+  unique_lock<mutex> queue(queue_mutex);
+  while (true) {
+    work.wait(queue, [this]{ return stopping || !jobs.empty(); });
+    //a stopping pool still runs what was queued
+    if (jobs.empty())
+      return;
+    function<void()> job = move(jobs.front());
+    jobs.pop_front();
+    ++running;
+    queue.unlock();
+    job();
+    queue.lock();
+    --running;
+    if (jobs.empty() && running == 0)
+      idle.notify_all();
+  }
+}
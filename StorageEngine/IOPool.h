@@ -0,0 +1,63 @@
+#ifndef IOPOOL_H_
+#define IOPOOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+///////////////////  IOPool  ///////////////////
+
+/*
+ * Worker threads that run page I/O jobs off the caller's thread, in
+ * the order they were submitted when there is one worker. StorageEngine
+ * reads pages ahead through it (see StorageEngine::prefetchPage).
+ *
+ * This is the only backend; there is no io_uring path. The build has
+ * no liburing, and a job is a whole PageStore::readPage call, which for
+ * TextPageStore and MmapPageStore is a memory copy no ring can take.
+ * Threads work for every store.
+ */
+class IOPool {
+ public:
+  IOPool() : running(0), stopping(false) {}
+  ~IOPool() {setThreads(0);}
+
+  /*
+   * Runs jobs on threads workers. Changing the number lets the
+   * current workers finish every queued job first; 0 leaves none.
+   */
+  void setThreads(unsigned threads);
+  unsigned threads() {return workers.size();}
+
+  /*
+   * Queues job for a worker; it must not throw. Without workers it
+   * is not run.
+   */
+  void submit(std::function<void()> job);
+
+  /*
+   * Waits until every job submitted so far has run.
+   */
+  void drain();
+
+ private:
+  std::mutex queue_mutex;
+  std::condition_variable work; //a job was queued, or stopping
+  std::condition_variable idle; //the queue ran dry
+  std::deque<std::function<void()> > jobs;
+  std::vector<std::thread> workers;
+  unsigned running; //jobs taken off the queue and not done yet
+  bool stopping;
+
+  void run();
+
+  IOPool(const IOPool&);
+  IOPool& operator=(const IOPool&);
+};
+
+/////////////////// End IOPool  ///////////////////
+
+#endif
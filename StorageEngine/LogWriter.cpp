@@ -0,0 +1,231 @@
+#include "LogWriter.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+LogWriter::LogWriter() :
+  fd(-1), segment_size(0), first_segment(0), segment(0), segments_found(false),
+  segment_bytes(0), sync_on_flush(false) {
+  buffer.reserve(4096);
+}
+
+LogWriter::~LogWriter() {
+  close();
+}
+
+void LogWriter::setFileName(string name) {
+  if (name != filename) {
+    close();
+    lock_guard<mutex> segments(segment_mutex);
+    segments_found = false;
+  }
+  filename = name;
+}
+
+void LogWriter::setSegmentSize(size_t bytes) {
+  lock_guard<mutex> segments(segment_mutex);
+  segment_size = bytes;
+  segments_found = false;
+}
+
+string LogWriter::segmentName(unsigned n) {
+  char suffix[16];
+  snprintf(suffix, sizeof(suffix), ".%06u", n);
+  return filename + suffix;
+}
+
+/*
+ * Looks in the log's directory for segments a previous run left.
+ * The caller holds segment_mutex.
+ */
+void LogWriter::findSegments() {
+  if (segments_found)
+    return;
+  segments_found = true;
+  first_segment = segment = 0;
+  if (!segment_size)
+    return;
+  size_t slash = filename.rfind('/');
+  string dir = slash == string::npos ? "." : filename.substr(0, slash);
+  string base = slash == string::npos ? filename : filename.substr(slash + 1);
+  DIR* d = opendir(dir.c_str());
+  if (!d)
+    return;
+  bool any = false;
+  while (dirent* e = readdir(d)) {
+    string name = e->d_name;
+    if (name.size() != base.size() + 7 || name.compare(0, base.size() + 1, base + ".") != 0)
+      continue;
+    char* end;
+    unsigned n = strtoul(name.c_str() + base.size() + 1, &end, 10);
+    if (*end)
+      continue;
+    if (!any || n < first_segment)
+      first_segment = n;
+    if (!any || n > segment)
+      segment = n;
+    any = true;
+  }
+  closedir(d);
+}
+
+unsigned LogWriter::firstSegment() {
+  lock_guard<mutex> segments(segment_mutex);
+  findSegments();
+  return first_segment;
+}
+
+unsigned LogWriter::lastSegment() {
+  lock_guard<mutex> segments(segment_mutex);
+  findSegments();
+  return segment;
+}
+
+bool LogWriter::removeSegment(unsigned n, const string& archive_dir) {
+  lock_guard<mutex> segments(segment_mutex);
+  findSegments();
+  if (n != first_segment || n >= segment)
+    return false;
+  string name = segmentName(n);
+  if (archive_dir.empty()) {
+    if (unlink(name.c_str()) == -1 && errno != ENOENT)
+      return false;
+  } else {
+    size_t slash = name.rfind('/');
+    string target = archive_dir + "/" + (slash == string::npos ? name : name.substr(slash + 1));
+    if (rename(name.c_str(), target.c_str()) == -1)
+      return false;
+  }
+  ++first_segment;
+  return true;
+}
+
+void LogWriter::append(const char* bytes, size_t len) {
+  buffer.insert(buffer.end(), bytes, bytes + len);
+}
+
+LogPosition LogWriter::position(size_t ahead) {
+  LogPosition at;
+  size_t bytes = segment_bytes;
+  {
+    lock_guard<mutex> segments(segment_mutex);
+    findSegments();
+    at.segment = segment;
+  }
+  if (fd == -1) {
+    //flush opens the file as it is
+    struct stat st;
+    string name = segment_size ? segmentName(at.segment) : filename;
+    bytes = stat(name.c_str(), &st) == 0 ? st.st_size : 0;
+  } else if (segment_size && segment_bytes >= segment_size && unwritten.empty()) {
+    //flush starts the next segment first
+    ++at.segment;
+    bytes = 0;
+  }
+  if (bytes == 0)
+    bytes = file_header.size();
+  at.offset = block_encoder ? bytes + unwritten.size() : bytes + buffer.size() + ahead;
+  return at;
+}
+
+/*
+ * Writes len bytes at out, retrying short and interrupted writes.
+ * done is how many reached the file, even when it fails.
+ */
+bool LogWriter::writeAll(const char* out, size_t len, size_t& done) {
+  done = 0;
+  while (done < len) {
+    ssize_t n = ::write(fd, out + done, len - done);
+    if (n == -1) {
+      if (errno == EINTR)
+	continue;
+      segment_bytes += done;
+      stats.bytes_written += done;
+      return false;
+    }
+    done += n;
+  }
+  segment_bytes += done;
+  stats.bytes_written += done;
+  return true;
+}
+
+bool LogWriter::flush() {
+  if (buffer.empty() && unwritten.empty())
+    return true;
+  if (fd != -1 && segment_size && segment_bytes >= segment_size && unwritten.empty()) {
+    close();
+    lock_guard<mutex> segments(segment_mutex);
+    ++segment;
+  }
+  if (fd == -1) {
+    string name = filename;
+    if (segment_size) {
+      lock_guard<mutex> segments(segment_mutex);
+      findSegments();
+      name = segmentName(segment);
+    }
+    fd = ::open(name.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd == -1)
+      return false;
+    struct stat st;
+    segment_bytes = fstat(fd, &st) == 0 ? st.st_size : 0;
+  }
+  size_t done;
+  if (!unwritten.empty()) {
+    //the rest of a block a failed flush began
+    bool ok = writeAll(unwritten.data(), unwritten.size(), done);
+    unwritten.erase(0, done);
+    if (!ok)
+      return false;
+  }
+  if (buffer.empty())
+    return sync();
+  size_t appended = buffer.size();
+  block.clear();
+  bool header = !file_header.empty() && segment_bytes == 0;
+  if (header)
+    block = file_header;
+  if (block_encoder) {
+    block_encoder(block, buffer.data(), buffer.size());
+    if (!writeAll(block.data(), block.size(), done)) {
+      //a retry must not encode again what is already half written
+      if (done) {
+	unwritten.assign(block, done, string::npos);
+	stats.bytes_appended += appended;
+	buffer.clear();
+      }
+      return false;
+    }
+  } else {
+    if (header)
+      buffer.insert(buffer.begin(), block.begin(), block.end());
+    if (!writeAll(buffer.data(), buffer.size(), done)) {
+      //keep only what did not reach the file; a header that did not
+      //start is added again by the retry
+      size_t keep = done || !header ? done : file_header.size();
+      buffer.erase(buffer.begin(), buffer.begin() + keep);
+      return false;
+    }
+  }
+  stats.bytes_appended += appended;
+  ++stats.flushes;
+  buffer.clear();
+  return sync();
+}
+
+bool LogWriter::sync() {
+  return !sync_on_flush || fdatasync(fd) == 0;
+}
+
+void LogWriter::close() {
+  if (fd != -1)
+    ::close(fd);
+  fd = -1;
+}
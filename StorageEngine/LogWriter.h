@@ -0,0 +1,160 @@
+#ifndef LOGWRITER_H_
+#define LOGWRITER_H_
+
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+ * How LogMgr encodes records: the tab separated text of
+ * LogRecord::toString, or the binary format of LogCodec.h.
+ */
+enum LogFormat {TEXT_LOG, BINARY_LOG};
+
+struct LogWriterStats {
+  unsigned long bytes_written;
+  unsigned long bytes_appended; //before any block encoding
+  unsigned long flushes;
+
+  LogWriterStats() : bytes_written(0), bytes_appended(0), flushes(0) {}
+
+  double averageFlushSize() {
+    return flushes ? (double)bytes_written / flushes : 0.0;
+  }
+};
+
+/*
+ * Where a byte of the log is: the segment (0 for a log that is one
+ * file) and the offset in that file, file header included.
+ */
+struct LogPosition {
+  unsigned segment;
+  uint64_t offset;
+
+  LogPosition() : segment(0), offset(0) {}
+};
+
+///////////////////  LogWriter  ///////////////////
+
+/*
+ * Appends to the log file through one file descriptor that stays open.
+ * Records are gathered in a contiguous buffer and written out together
+ * by flush(), so forcing n records costs one write instead of n
+ * open/write/close round trips.
+ */
+class LogWriter {
+ public:
+  LogWriter();
+  ~LogWriter();
+
+  /*
+   * Sets the file to append to. It is opened (and created if missing)
+   * by the first flush.
+   */
+  void setFileName(std::string filename);
+
+  /*
+   * If on, every flush is followed by fdatasync. Off by default.
+   */
+  void setSync(bool on) {sync_on_flush = on;}
+
+  /*
+   * Bytes written first whenever flush finds the file empty,
+   * e.g. the file header of a binary log.
+   */
+  void setFileHeader(const std::string& header) {file_header = header;}
+
+  /*
+   * If set, flush hands the buffer to encode, which appends what is
+   * written in its place, so every flush writes one block, e.g. a
+   * compressed frame. Unset by default.
+   */
+  typedef std::function<void(std::string&, const char*, size_t)> BlockEncoder;
+  void setBlockEncoder(BlockEncoder encode) {block_encoder = encode;}
+
+  /*
+   * Adds bytes to the log buffer. Nothing reaches the file until flush().
+   */
+  void append(const char* bytes, size_t len);
+  void append(const std::string& bytes) {append(bytes.data(), bytes.length());}
+
+  /*
+   * Writes the whole buffer with one write call (more only if the
+   * kernel accepts a partial write) and empties it. Returns false if
+   * the file could not be opened, written or synced; whatever did not
+   * reach the file stays buffered for the next flush.
+   */
+  bool flush();
+
+  /*
+   * Drops whatever is buffered, as a crash would.
+   */
+  void discard() {buffer.clear(); unwritten.clear();}
+
+  /*
+   * Where a byte appended after ahead more bytes will be once it is
+   * flushed. With a block encoder, bytes have no offset of their own:
+   * this is where the block that holds them will start.
+   */
+  LogPosition position(size_t ahead = 0);
+
+  size_t buffered() {return buffer.size();}
+  void close();
+  LogWriterStats getStats() {return stats;}
+
+  /*
+   * Splits the log into segment files of about bytes each (0, the
+   * default, keeps one file). Segment n is the file name followed by
+   * "." and n as six digits; a flush that finds the current segment
+   * full starts the next one, so a flush never spans two segments.
+   * Segments already on disk are picked up where they left off.
+   * Must be set before the first flush.
+   */
+  void setSegmentSize(size_t bytes);
+  size_t getSegmentSize() {return segment_size;}
+
+  /*
+   * The segments on disk run from firstSegment() to lastSegment();
+   * both are 0 before anything was written.
+   */
+  unsigned firstSegment();
+  unsigned lastSegment();
+  std::string segmentName(unsigned n);
+
+  /*
+   * Deletes segment n, or moves it into archive_dir if that is not
+   * empty. Only the oldest segment may go, and never the one being
+   * written. Returns false if it was not removed.
+   */
+  bool removeSegment(unsigned n, const std::string& archive_dir);
+
+ private:
+  int fd;
+  std::string filename;
+  size_t segment_size;
+  unsigned first_segment;
+  unsigned segment; //the one being written
+  bool segments_found; //existing segments looked up
+  size_t segment_bytes; //size of the current segment
+  std::mutex segment_mutex; //the segment numbers, for readers and removeSegment
+  void findSegments();
+  std::string file_header;
+  BlockEncoder block_encoder;
+  std::string block;
+  std::string unwritten; //tail of a block a failed flush left half written
+  std::vector<char> buffer;
+  bool sync_on_flush;
+  bool writeAll(const char* out, size_t len, size_t& done);
+  bool sync();
+  LogWriterStats stats;
+
+  LogWriter(const LogWriter&);
+  LogWriter& operator=(const LogWriter&);
+};
+
+/////////////////// End LogWriter  ///////////////////
+
+#endif
@@ -0,0 +1,218 @@
+#include "PageFile.h"
+#include "Checksum.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using namespace std;
+
+uint32_t pageFileHeaderChecksum(PageFileHeader h) {
+  h.checksum = 0;
+  return crc32(&h, sizeof(h));
+}
+
+uint32_t pageChecksum(const PageHeader& ph, const char* data) {
+  uint32_t crc = crc32(&ph.pageLSN, sizeof(ph.pageLSN));
+  crc = crc32(&ph.length, sizeof(ph.length), crc);
+  return crc32(data, ph.length, crc);
+}
+
+PageFile::PageFile() : fd(-1), zeros(NULL) {
+  memset(&header, 0, sizeof(header));
+}
+
+PageFile::~PageFile() {
+  close();
+}
+
+bool PageFile::isPageFile(string filename) {
+  char magic[sizeof(PAGE_FILE_MAGIC)];
+  ifstream in(filename, ios::binary);
+  if (!in.read(magic, sizeof(magic)))
+    return false;
+  return memcmp(magic, PAGE_FILE_MAGIC, sizeof(magic)) == 0;
+}
+
+bool PageFile::create(string name, unsigned page_size, int page_count) {
+  close();
+  fd = ::open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1)
+    return false;
+  filename = name;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, PAGE_FILE_MAGIC, sizeof(header.magic));
+  header.version = PAGE_FILE_VERSION;
+  header.page_size = page_size;
+  header.page_count = page_count;
+  header.checksum = pageFileHeaderChecksum(header);
+
+  char block[PAGE_FILE_HEADER_SIZE];
+  memset(block, 0, sizeof(block));
+  memcpy(block, &header, sizeof(header));
+  if (pwrite(fd, block, sizeof(block), 0) != (ssize_t)sizeof(block)) {
+    close();
+    return false;
+  }
+  zeros = (char*)calloc(1, header.page_size + 1);
+  //every slot starts out as an empty page with pageLSN -1
+  for (int i = 1; i <= page_count; ++i)
+    if (!writePage(i, -1, zeros, 0)) {
+      close();
+      return false;
+    }
+  return true;
+}
+
+bool PageFile::open(string name) {
+  close();
+  fd = ::open(name.c_str(), O_RDWR);
+  if (fd == -1)
+    return false;
+  if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+      memcmp(header.magic, PAGE_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != PAGE_FILE_VERSION ||
+      header.checksum != pageFileHeaderChecksum(header)) {
+    close();
+    return false;
+  }
+  filename = name;
+  zeros = (char*)calloc(1, header.page_size + 1);
+  return true;
+}
+
+void PageFile::close() {
+  if (fd != -1)
+    ::close(fd);
+  fd = -1;
+  free(zeros);
+  zeros = NULL;
+}
+
+bool PageFile::readPage(int page_id, int& pageLSN, char* buf, unsigned& length) {
+  if (page_id < 1 || page_id > (int)header.page_count)
+    return false;
+  //straight into buf, so reads of different pages can run at once
+  PageHeader ph;
+  struct iovec iov[2] = {{&ph, sizeof(ph)}, {buf, header.page_size}};
+  if (preadv(fd, iov, 2, pageSlotOffset(page_id, header.page_size)) != (ssize_t)slotSize())
+    return false;
+  if (ph.length > header.page_size || ph.checksum != pageChecksum(ph, buf))
+    throw runtime_error("PageFile: checksum mismatch on page " + to_string(page_id));
+  pageLSN = ph.pageLSN;
+  length = ph.length;
+  return true;
+}
+
+bool PageFile::writePage(int page_id, int pageLSN, const char* buf, unsigned length) {
+  if (page_id < 1 || page_id > (int)header.page_count || length > header.page_size)
+    return false;
+  PageHeader ph;
+  struct iovec iov[3];
+  slotVector(ph, iov, pageLSN, buf, length);
+  return pwritev(fd, iov, 3, pageSlotOffset(page_id, header.page_size)) == (ssize_t)slotSize();
+}
+
+/*
+ * Fills in the header of a page and the three pieces of its slot:
+ * the header, the page, and zeros to fill the slot.
+ */
+void PageFile::slotVector(PageHeader& ph, struct iovec* iov, int pageLSN, const char* buf, unsigned length) {
+  ph.pageLSN = pageLSN;
+  ph.length = length;
+  ph.checksum = pageChecksum(ph, buf);
+  ph.reserved = 0;
+  iov[0].iov_base = &ph;
+  iov[0].iov_len = sizeof(ph);
+  iov[1].iov_base = (void*)buf;
+  iov[1].iov_len = length;
+  iov[2].iov_base = zeros;
+  iov[2].iov_len = header.page_size - length;
+}
+
+bool PageFile::writePages(int first_page_id, unsigned n, const int* pageLSNs,
+			  const char* const* bufs, const unsigned* lengths) {
+  if (first_page_id < 1 || first_page_id + (long)n - 1 > (long)header.page_count)
+    return false;
+  const unsigned per_write = IOV_MAX / 3;
+  vector<PageHeader> ph(min(n, per_write));
+  vector<struct iovec> iov(3 * ph.size());
+  for (unsigned done = 0; done < n; ) {
+    unsigned count = min(n - done, per_write);
+    for (unsigned k = 0; k < count; ++k) {
+      if (lengths[done + k] > header.page_size)
+	return false;
+      slotVector(ph[k], &iov[3 * k], pageLSNs[done + k], bufs[done + k], lengths[done + k]);
+    }
+    ssize_t bytes = (ssize_t)count * slotSize();
+    if (pwritev(fd, iov.data(), 3 * count, pageSlotOffset(first_page_id + done, header.page_size)) != bytes)
+      return false;
+    done += count;
+  }
+  return true;
+}
+
+bool PageFile::sync() {
+  return fd == -1 || fdatasync(fd) == 0;
+}
+
+bool textToPageFile(string text_filename, string page_filename, unsigned page_size) {
+  ifstream dbf(text_filename);
+  if (!dbf)
+    return false;
+  vector<int> lsns;
+  vector<string> pages;
+  int pageLSN = 0;
+  string data;
+  unsigned longest = 0;
+  //same parsing as StorageEngine::start
+  while (dbf >> pageLSN) {
+    dbf.get();
+    if (!getline(dbf, data))
+      break;
+    lsns.push_back(pageLSN);
+    pages.push_back(data);
+    if (data.length() > longest)
+      longest = data.length();
+  }
+  if (page_size == 0)
+    page_size = (longest + 63) / 64 * 64;
+  if (longest > page_size)
+    return false;
+
+  PageFile pf;
+  if (!pf.create(page_filename, page_size, pages.size()))
+    return false;
+  for (unsigned i = 0; i < pages.size(); ++i)
+    if (!pf.writePage(i + 1, lsns[i], pages[i].data(), pages[i].length()))
+      return false;
+  return pf.sync();
+}
+
+bool pageFileToText(string page_filename, string text_filename) {
+  PageFile pf;
+  if (!pf.open(page_filename))
+    return false;
+  ofstream dbf(text_filename);
+  if (!dbf)
+    return false;
+  vector<char> buf(pf.pageSize());
+  for (int i = 1; i <= pf.pageCount(); ++i) {
+    int pageLSN;
+    unsigned length;
+    if (!pf.readPage(i, pageLSN, buf.data(), length))
+      return false;
+    //same layout as StorageEngine::end
+    dbf << pageLSN << ' ';
+    dbf.write(buf.data(), length);
+    dbf << endl;
+  }
+  dbf.close();
+  return !dbf.fail();
+}
@@ -0,0 +1,140 @@
+#ifndef PAGEFILE_H_
+#define PAGEFILE_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <string>
+
+/*
+ * Binary database file made of fixed-size page slots.
+ *
+ *   offset 0                  PageFileHeader, padded to PAGE_FILE_HEADER_SIZE
+ *   header + (id-1) * slot    PageHeader followed by page_size data bytes
+ *
+ * Page ids start at 1, like the line numbers of the text format.
+ * Integers are stored in host byte order.
+ */
+
+const char PAGE_FILE_MAGIC[8] = {'A', 'R', 'I', 'E', 'S', 'P', 'G', '\n'};
+const uint32_t PAGE_FILE_VERSION = 1;
+const unsigned PAGE_FILE_HEADER_SIZE = 64;
+
+struct PageFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t page_size;  //data bytes per page slot
+  uint32_t page_count;
+  uint32_t checksum;   //crc32 of the header with this field set to 0
+};
+
+struct PageHeader {
+  int32_t pageLSN;
+  uint32_t length;     //bytes of the slot holding page data
+  uint32_t checksum;   //crc32 of pageLSN, length and the data bytes
+  uint32_t reserved;
+};
+
+/*
+ * Value stored in PageFileHeader::checksum.
+ */
+uint32_t pageFileHeaderChecksum(PageFileHeader h);
+
+/*
+ * Value stored in PageHeader::checksum for a page with header ph
+ * and ph.length bytes of data.
+ */
+uint32_t pageChecksum(const PageHeader& ph, const char* data);
+
+/*
+ * Byte offset of the slot of page_id in a file with page_size data
+ * bytes per page.
+ */
+inline off_t pageSlotOffset(int page_id, unsigned page_size) {
+  return PAGE_FILE_HEADER_SIZE + (off_t)(page_id - 1) * (sizeof(PageHeader) + page_size);
+}
+
+///////////////////  PageFile  ///////////////////
+
+class PageFile {
+ public:
+  PageFile();
+  ~PageFile();
+
+  /*
+   * Returns true if filename starts with the page file magic.
+   */
+  static bool isPageFile(std::string filename);
+
+  /*
+   * Creates (or truncates) filename as an empty page file of
+   * page_count zero-length pages and leaves it open.
+   */
+  bool create(std::string filename, unsigned page_size, int page_count);
+
+  /*
+   * Opens an existing page file for reading and writing.
+   * Returns false if it is missing or its header is damaged.
+   */
+  bool open(std::string filename);
+
+  void close();
+  bool isOpen() {return fd != -1;}
+
+  /*
+   * Reads page page_id with one preadv. buf must hold pageSize() bytes.
+   * Throws runtime_error if the page checksum does not match.
+   * Safe to call from several threads, alongside one writer.
+   */
+  bool readPage(int page_id, int& pageLSN, char* buf, unsigned& length);
+
+  /*
+   * Writes page page_id in place with one pwritev.
+   */
+  bool writePage(int page_id, int pageLSN, const char* buf, unsigned length);
+
+  /*
+   * Writes the n pages from first_page_id on, whose slots are next to
+   * each other, with one vectored pwrite (a few for a very long run).
+   */
+  bool writePages(int first_page_id, unsigned n, const int* pageLSNs,
+		  const char* const* bufs, const unsigned* lengths);
+
+  /*
+   * Makes every write so far durable. Returns false if fdatasync fails.
+   */
+  bool sync();
+
+  int pageCount() {return header.page_count;}
+  unsigned pageSize() {return header.page_size;}
+  std::string fileName() {return filename;}
+
+ private:
+  int fd;
+  std::string filename;
+  PageFileHeader header;
+  char* zeros; //fills a slot past the end of its page
+
+  unsigned slotSize() {return sizeof(PageHeader) + header.page_size;}
+  void slotVector(PageHeader& ph, struct iovec* iov, int pageLSN, const char* buf, unsigned length);
+
+  PageFile(const PageFile&);
+  PageFile& operator=(const PageFile&);
+};
+
+/////////////////// End PageFile  ///////////////////
+
+/*
+ * Converts the text layout of sampleDBFile.txt ("pageLSN data" per line)
+ * into a page file. page_size 0 uses the longest page rounded up to a
+ * multiple of 64 bytes. Returns false if either file cannot be opened.
+ */
+bool textToPageFile(std::string text_filename, std::string page_filename,
+		    unsigned page_size = 0);
+
+/*
+ * Writes a page file back out in the text layout.
+ */
+bool pageFileToText(std::string page_filename, std::string text_filename);
+
+#endif
@@ -0,0 +1,195 @@
+#include "PageStore.h"
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+PageStore* PageStore::open(string db_filename, StorageBackendType backend) {
+  if (!PageFile::isPageFile(db_filename)) {
+    TextPageStore* text = new TextPageStore();
+    if (text->open(db_filename))
+      return text;
+    delete text;
+    return NULL;
+  }
+  if (backend == MMAP_BACKEND) {
+    MmapPageStore* mapped = new MmapPageStore();
+    if (mapped->open(db_filename))
+      return mapped;
+    delete mapped;
+    return NULL;
+  }
+  PreadPageStore* file = new PreadPageStore();
+  if (file->open(db_filename))
+    return file;
+  delete file;
+  return NULL;
+}
+
+bool PageStore::writePages(int first_page_id, unsigned n, const int* pageLSNs,
+			   const char* const* bufs, const unsigned* lengths) {
+  bool ok = true;
+  for (unsigned k = 0; k < n; ++k)
+    ok = writePage(first_page_id + k, pageLSNs[k], bufs[k], lengths[k]) && ok;
+  return ok;
+}
+
+///////////////////  TextPageStore  ///////////////////
+
+bool TextPageStore::open(string db_filename) {
+  ifstream dbf(db_filename);
+  if (!dbf)
+    return false;
+  int page_id = 1;
+  int pageLSN = 0;
+  string data = "";
+  longest = 0;
+  while(true) {
+    if(!(dbf >> pageLSN))
+      break;
+    dbf.get();
+    if(!getline(dbf, data))
+      break;
+
+    Page p = Page(page_id, pageLSN, false, data);
+    onDisk.push_back(p);
+    if (data.length() > longest)
+      longest = data.length();
+
+    ++page_id;
+  }
+
+  dbf.close();
+  return true;
+}
+
+bool TextPageStore::readPage(int page_id, int& pageLSN, char* buf, unsigned& length) {
+  Page& p = onDisk[page_id-1];
+  pageLSN = p.pageLSN;
+  length = p.data.length();
+  memcpy(buf, p.data.data(), length);
+  return true;
+}
+
+bool TextPageStore::writePage(int page_id, int pageLSN, const char* buf, unsigned length) {
+  //assign() reuses the string's buffer, pages keep their length
+  onDisk[page_id-1].pageLSN = pageLSN;
+  onDisk[page_id-1].data.assign(buf, length);
+  return true;
+}
+
+void TextPageStore::end(string db_filename) {
+  //For each page in onDisk,
+    //write the page to db_filename
+  ofstream dbf(db_filename);
+  for(unsigned i = 0; i < onDisk.size(); ++i) {
+    dbf << onDisk[i].pageLSN << ' ' << onDisk[i].data << endl;
+  }
+  dbf.close();
+  if (dbf.fail())
+    throw runtime_error("TextPageStore: cannot write " + db_filename);
+}
+
+/////////////////// End TextPageStore  ///////////////////
+
+///////////////////  PreadPageStore  ///////////////////
+
+void PreadPageStore::end(string) {
+  //every flushed page was already written in place
+  bool synced = file.sync();
+  file.close();
+  if (!synced)
+    throw runtime_error("PreadPageStore: cannot sync the page file");
+}
+
+/////////////////// End PreadPageStore  ///////////////////
+
+///////////////////  MmapPageStore  ///////////////////
+
+MmapPageStore::~MmapPageStore() {
+  close();
+}
+
+bool MmapPageStore::open(string db_filename) {
+  //PageFile validates the header
+  PageFile check;
+  if (!check.open(db_filename))
+    return false;
+  check.close();
+
+  fd = ::open(db_filename.c_str(), O_RDWR);
+  if (fd == -1)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close();
+    return false;
+  }
+  map_size = st.st_size;
+  void* m = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (m == MAP_FAILED) {
+    close();
+    return false;
+  }
+  map = (char*)m;
+  memcpy(&header, map, sizeof(header));
+  if ((size_t)pageSlotOffset(header.page_count + 1, header.page_size) > map_size) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void MmapPageStore::close() {
+  if (map)
+    munmap(map, map_size);
+  map = NULL;
+  if (fd != -1)
+    ::close(fd);
+  fd = -1;
+}
+
+bool MmapPageStore::readPage(int page_id, int& pageLSN, char* buf, unsigned& length) {
+  if (page_id < 1 || page_id > (int)header.page_count)
+    return false;
+  const char* slot = map + pageSlotOffset(page_id, header.page_size);
+  PageHeader ph;
+  memcpy(&ph, slot, sizeof(ph));
+  const char* data = slot + sizeof(ph);
+  if (ph.length > header.page_size || ph.checksum != pageChecksum(ph, data))
+    throw runtime_error("MmapPageStore: checksum mismatch on page " + to_string(page_id));
+  pageLSN = ph.pageLSN;
+  length = ph.length;
+  memcpy(buf, data, length);
+  return true;
+}
+
+bool MmapPageStore::writePage(int page_id, int pageLSN, const char* buf, unsigned length) {
+  if (page_id < 1 || page_id > (int)header.page_count || length > header.page_size)
+    return false;
+  char* slot = map + pageSlotOffset(page_id, header.page_size);
+  PageHeader ph;
+  ph.pageLSN = pageLSN;
+  ph.length = length;
+  ph.checksum = pageChecksum(ph, buf);
+  ph.reserved = 0;
+  memcpy(slot + sizeof(ph), buf, length);
+  memset(slot + sizeof(ph) + length, 0, header.page_size - length);
+  memcpy(slot, &ph, sizeof(ph));
+  return true;
+}
+
+void MmapPageStore::end(string) {
+  //every flushed page was already written to the mapping
+  bool synced = !map || msync(map, map_size, MS_SYNC) == 0;
+  close();
+  if (!synced)
+    throw runtime_error("MmapPageStore: cannot sync the page file");
+}
+
+/////////////////// End MmapPageStore  ///////////////////
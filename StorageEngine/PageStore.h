@@ -0,0 +1,183 @@
+#ifndef PAGESTORE_H_
+#define PAGESTORE_H_
+
+#include <string>
+#include <vector>
+#include "PageFile.h"
+
+struct Page {
+    int page_id; //equal to the line number where it's stored in the file.
+    int pageLSN;
+    bool dirty;
+    std::string data;
+
+    Page() {
+        dirty = false;
+    }
+
+    Page(int new_page_id, int new_pageLSN, bool new_dirty, std::string new_data) {
+        page_id = new_page_id;
+        pageLSN = new_pageLSN;
+        dirty = new_dirty;
+        data = new_data;
+    }
+};
+
+/*
+ * How a binary page file is accessed. Text databases always use
+ * TextPageStore.
+ */
+enum StorageBackendType {PREAD_BACKEND, MMAP_BACKEND};
+
+///////////////////  PageStore  ///////////////////
+
+/*
+ * The "disk" under the buffer pool. StorageEngine only moves pages
+ * through this interface, so it does not care how they are stored.
+ * Page ids run from 1 to pageCount().
+ */
+class PageStore {
+ public:
+  virtual ~PageStore() {}
+
+  /*
+   * Opens db_filename with the backend that fits it: a text database
+   * gets a TextPageStore, a page file gets the requested backend.
+   * Returns NULL if the file cannot be opened.
+   */
+  static PageStore* open(std::string db_filename, StorageBackendType backend);
+
+  virtual int pageCount() = 0;
+
+  /*
+   * Bytes a buffer frame needs to hold the largest page.
+   */
+  virtual unsigned pageSize() = 0;
+
+  /*
+   * Most bytes a page may grow to, 0 if pages can grow freely.
+   */
+  virtual unsigned capacity() = 0;
+
+  /*
+   * Copies page page_id into buf, which holds at least pageSize() bytes.
+   * Reads may run on I/O threads, alongside each other and alongside
+   * writes of other pages; writes come one at a time.
+   */
+  virtual bool readPage(int page_id, int& pageLSN, char* buf, unsigned& length) = 0;
+
+  /*
+   * Stores page page_id. The caller has already forced the log
+   * (LogMgr::pageFlushed), nothing reaches the store before that.
+   */
+  virtual bool writePage(int page_id, int pageLSN, const char* buf, unsigned length) = 0;
+
+  /*
+   * Stores the n pages from first_page_id on, as n writePage calls
+   * would. A page file does it with one vectored write.
+   */
+  virtual bool writePages(int first_page_id, unsigned n, const int* pageLSNs,
+			  const char* const* bufs, const unsigned* lengths);
+
+  /*
+   * Makes the stored pages durable at the end of a test case.
+   * TextPageStore writes every page to db_filename. The page file
+   * backends only sync the file they were opened on, where flushed
+   * pages were already written in place; dbconvert -t turns it into
+   * text. Throws runtime_error if the pages cannot be made durable.
+   */
+  virtual void end(std::string db_filename) = 0;
+};
+
+/////////////////// End PageStore  ///////////////////
+
+///////////////////  TextPageStore  ///////////////////
+
+/*
+ * The whole text database (sampleDBFile.txt layout) held in memory.
+ */
+class TextPageStore : public PageStore {
+ public:
+  TextPageStore() : longest(0) {}
+
+  bool open(std::string db_filename);
+
+  int pageCount() {return onDisk.size();}
+  unsigned pageSize() {return longest;}
+  unsigned capacity() {return 0;}
+  bool readPage(int page_id, int& pageLSN, char* buf, unsigned& length);
+  bool writePage(int page_id, int pageLSN, const char* buf, unsigned length);
+  void end(std::string db_filename);
+
+ private:
+  std::vector<Page> onDisk;
+  unsigned longest;
+};
+
+/////////////////// End TextPageStore  ///////////////////
+
+///////////////////  PreadPageStore  ///////////////////
+
+/*
+ * A page file read and written one page at a time with pread/pwrite.
+ */
+class PreadPageStore : public PageStore {
+ public:
+  bool open(std::string db_filename) {return file.open(db_filename);}
+
+  int pageCount() {return file.pageCount();}
+  unsigned pageSize() {return file.pageSize();}
+  unsigned capacity() {return file.pageSize();}
+  bool readPage(int page_id, int& pageLSN, char* buf, unsigned& length) {
+    return file.readPage(page_id, pageLSN, buf, length);
+  }
+  bool writePage(int page_id, int pageLSN, const char* buf, unsigned length) {
+    return file.writePage(page_id, pageLSN, buf, length);
+  }
+  bool writePages(int first_page_id, unsigned n, const int* pageLSNs,
+		  const char* const* bufs, const unsigned* lengths) {
+    return file.writePages(first_page_id, n, pageLSNs, bufs, lengths);
+  }
+  void end(std::string db_filename);
+
+ private:
+  PageFile file;
+};
+
+/////////////////// End PreadPageStore  ///////////////////
+
+///////////////////  MmapPageStore  ///////////////////
+
+/*
+ * A page file mapped into memory with MAP_SHARED; the mapping is the
+ * on-disk view and the OS decides which of it stays resident. Opening
+ * costs one mmap call regardless of the size of the database.
+ * Buffer frames are separate copies, so a modified page only reaches the
+ * mapping through writePage, after the log has been forced.
+ */
+class MmapPageStore : public PageStore {
+ public:
+  MmapPageStore() : fd(-1), map(NULL), map_size(0) {}
+  ~MmapPageStore();
+
+  bool open(std::string db_filename);
+
+  int pageCount() {return header.page_count;}
+  unsigned pageSize() {return header.page_size;}
+  unsigned capacity() {return header.page_size;}
+  bool readPage(int page_id, int& pageLSN, char* buf, unsigned& length);
+  bool writePage(int page_id, int pageLSN, const char* buf, unsigned length);
+  void end(std::string db_filename);
+
+ private:
+  int fd;
+  char* map;
+  size_t map_size;
+  PageFileHeader header;
+
+  void close();
+};
+
+/////////////////// End MmapPageStore  ///////////////////
+
+#endif
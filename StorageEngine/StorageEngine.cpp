@@ -1,15 +1,34 @@
 #include "StorageEngine.h"
 #include "../StudentComponent/LogMgr.h"
+#include "../StudentComponent/LogCodec.h"
+#include "Checksum.h"
+#include <cstddef>
+#include <cstdio>
 #include <cstring>
 #include <string>
 #include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <stdexcept>
+#include <algorithm>
+#include <iterator>
+#include <fcntl.h>
+#include <unistd.h>
 
 using namespace std;
 
-StorageEngine::StorageEngine() : MEMORY_SIZE(10) {
+StorageEngine::StorageEngine(unsigned memory_size, ReplacementPolicyType policy,
+			     unsigned page_size, StorageBackendType backend) :
+  onDisk(NULL), BACKEND(backend), MEMORY_SIZE(memory_size), PAGE_SIZE(page_size),
+  records(MEMORY_SIZE, policy) {
     page_writes_permitted = 0;
 }
 
+StorageEngine::~StorageEngine() {
+  io.setThreads(0);
+  delete onDisk;
+}
+
 /* 
  * 
  * Starts the storage engine with a database by reading the database from a file
@@ -21,39 +40,26 @@ void StorageEngine::start(string db_filename, LogMgr* log_mgr_ptr, string testca
   log_filename = "output/log/log";
   log_filename.append(testcase_num);
   log_filename.append(".log");
+  log_writer.setFileName(log_filename);
+  loadMaster();
 
   output_filename = "output/dbs/db";
   output_filename.append(testcase_num);
   output_filename.append(".db");
 
-  ifstream dbf(db_filename);
-  int page_id = 1;
-  int pageLSN = 0;
-  string data = "";
-  while(true) {
-    if(!(dbf >> pageLSN))
-      break;
-    dbf.get();
-    if(!getline(dbf, data))
-      break;
-
-    Page p = Page(page_id, pageLSN, false, data);
-    onDisk.push_back(p);
-
-    ++page_id;
-  }
-
-  dbf.close();
+  io.drain();
+  prefetched_frames = 0;
+  delete onDisk;
+  onDisk = PageStore::open(db_filename, BACKEND);
+  if (!onDisk)
+    throw runtime_error("StorageEngine: cannot open database " + db_filename);
+  records.allocate(max(PAGE_SIZE, onDisk->pageSize()));
 }
 
 void StorageEngine::end(string db_filename) {
-  //For each page in onDisk, 
-    //write the page to db_filename 
-  ofstream dbf(db_filename);
-  for(unsigned i = 0; i < onDisk.size(); ++i) {
-    dbf << onDisk[i].pageLSN << ' ' << onDisk[i].data << endl;
-  }
-  dbf.close();
+  lm_ptr->finishRestart();
+  io.drain();
+  onDisk->end(db_filename);
 }
 
 /* 
@@ -61,7 +67,7 @@ void StorageEngine::end(string db_filename) {
  * Sets page_writes_permitted to safe_writes. This is how many writes will
  * be allowed before the next crash occurs.
  * Replaces the old lm_ptr with log_mgr_ptr.
- * Empties the records vector (our page buffer).
+ * Empties the records buffer (our page buffer).
  * Reads the log from log_entries
  * Calls lm_ptr ->recover()
  * 
@@ -69,7 +75,11 @@ void StorageEngine::end(string db_filename) {
 void StorageEngine::crash(int safe_writes, LogMgr* log_mgr_ptr) {
   page_writes_permitted = safe_writes;
   lm_ptr = log_mgr_ptr;
+  //nothing may still be reading into the frames
+  io.drain();
   records.clear();
+  prefetched_frames = 0;
+  log_writer.discard();
   string log = getLog();
   lm_ptr->recover(log);
 }
@@ -87,22 +97,101 @@ void StorageEngine::end_crash(LogMgr* log_mgr_ptr) {
  *
  */
 void StorageEngine::updateLog(string log_entries) {
-//find the file called [log_filename]. If it doesn't exist, create it.
-//Append the string log_entries to the end of it.
-//Close it.
-    ofstream myfile;
-    myfile.open(log_filename, std::ios_base::app);
-    if (!myfile.is_open()){
-        std::ofstream outfile (log_filename);
-        outfile << log_entries;
-        outfile.close();
-    }
-    else{
-        myfile << log_entries;
+  appendLog(log_entries);
+  forceLog();
+}
+
+/*
+ * appendLog(log_entries)
+ *
+ * Buffers log entries in memory until the next forceLog.
+ */
+void StorageEngine::appendLog(const string& log_entries) {
+  log_writer.append(log_entries);
+}
+
+void StorageEngine::appendLog(const char* log_entries, size_t length) {
+  log_writer.append(log_entries, length);
+}
+
+/*
+ * forceLog()
+ *
+ * Writes everything buffered by appendLog to the end of the log file.
+ * The file is created if it doesn't exist.
+ */
+void StorageEngine::forceLog() {
+  //a log that did not reach the disk must not let pages or commits follow it
+  if (!log_writer.flush())
+    throw runtime_error("StorageEngine::forceLog: cannot write the log");
+}
+
+void StorageEngine::setLogSync(bool on) {
+  log_writer.setSync(on);
+}
+
+void StorageEngine::setLogFormat(LogFormat format) {
+  log_format = format;
+  bool framed = format == BINARY_LOG && log_compressed;
+  log_writer.setFileHeader(format == BINARY_LOG ? binaryLogFileHeader(framed) : "");
+  log_writer.setBlockEncoder(framed ? LogWriter::BlockEncoder(appendFrame) : LogWriter::BlockEncoder());
+}
+
+void StorageEngine::setLogCompression(bool on) {
+  log_compressed = on;
+  setLogFormat(log_format);
+}
+
+LogFormat StorageEngine::getLogFormat() {
+  return log_format;
+}
+
+void StorageEngine::setLogSegmentSize(size_t bytes, string archive_dir) {
+  log_writer.setSegmentSize(bytes);
+  log_archive_dir = archive_dir;
+}
+
+/*
+ * LSN of the first record in segment n, or -1 if it has none.
+ */
+int StorageEngine::segmentFirstLSN(unsigned n) {
+  ifstream input(log_writer.segmentName(n), ios::binary);
+  if (log_format == BINARY_LOG) {
+    char file_header[LOG_FILE_HEADER_SIZE];
+    BinaryLogHeader h;
+    if (!input.read(file_header, sizeof(file_header)))
+      return -1;
+    if (isFramedLog(file_header, sizeof(file_header))) {
+      LogFrameHeader frame;
+      if (!input.read((char*)&frame, sizeof(frame)))
+	return -1;
+      return frame.first_lsn;
     }
-    
-    myfile.close();
-    
+    if (!input.read((char*)&h, sizeof(h)))
+      return -1;
+    return h.lsn;
+  }
+  string first;
+  if (!getline(input, first, '\t') || first.empty())
+    return -1;
+  return atoi(first.c_str());
+}
+
+void StorageEngine::truncateLog(int lsn) {
+  if (!log_writer.getSegmentSize())
+    return;
+  unsigned n = log_writer.firstSegment();
+  while (n < log_writer.lastSegment()) {
+    //everything in n comes before the first record of n + 1
+    int next = segmentFirstLSN(n + 1);
+    if (next == -1 || next > lsn || !log_writer.removeSegment(n, log_archive_dir))
+      break;
+    ++n;
+  }
+}
+
+LogWriterStats StorageEngine::getLogStats() {
+  return log_writer.getStats();
 }
 
 /* 
@@ -113,18 +202,105 @@ void StorageEngine::updateLog(string log_entries) {
  * 
  */
 void StorageEngine::write(int txid, int page_id, int offset, string input) {
-    //Use findPage() to get the page's location in records vector
-    int getindex = findPage(page_id);
+    //Use pinPage() to get the page's frame in the records buffer,
+    //pinned and latched so no other thread changes or evicts it meanwhile
+    lm_ptr->pageNeeded(txid, page_id);
+    PageGuard page = pinPage(page_id);
+    if (!page.valid())
+      throw out_of_range("StorageEngine::write");
+    //check the bounds updateFrame would before anything is read or logged
+    unsigned capacity = onDisk->capacity() ? onDisk->capacity() : records.pageSize();
+    if (offset < 0 || (unsigned)offset > page.length() || offset + input.length() > capacity)
+      throw out_of_range("StorageEngine::write");
     //old = whatever's on the page at the offset; length of old should be same as length of input
-    string old;
-    for (unsigned i = 0; i<input.length(); ++i) {
-      old += records[getindex].data[offset+i];
-    }
+    zeroFrame(page.frame(), offset, input.length());
+    string old(page.data() + offset, input.length());
     int pageLSN = lm_ptr->write(txid, page_id, offset, input, old);
     //write the updated page
-    updatePage(page_id, offset, input);
+    updateFrame(page.frame(), offset, input);
     //and update the pageLSN for the page
-    updateLSN(page_id, pageLSN);
+    page.setPageLSN(pageLSN);
+}
+
+void StorageEngine::write(int txid, const PageWrite* writes, size_t n) {
+  vector<size_t> order(n);
+  for (size_t k = 0; k < n; ++k)
+    order[k] = k;
+  stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return writes[a].page_id < writes[b].page_id;
+  });
+  //before anything is pinned, as it may roll back losers
+  for (size_t k = 0; k < n; ++k) {
+    if (k == 0 || writes[order[k]].page_id != writes[order[k - 1]].page_id)
+      lm_ptr->pageNeeded(txid, writes[order[k]].page_id);
+  }
+  unsigned capacity = onDisk->capacity() ? onDisk->capacity() : records.pageSize();
+  size_t window = max(1u, records.size() / 2);
+  vector<PageGuard> pages;
+  vector<size_t> page_end; //where each page's writes end in batch
+  vector<unsigned> old_lengths;
+  vector<bool> was_dirty;
+  vector<PageWrite> batch;
+  vector<string> olds;
+  pages.reserve(window);
+  for (size_t first = 0; first < n; ) {
+    //Pin and latch the next pages in page_id order, which is what
+    //keeps two batches from waiting on each other's latches. Only the
+    //first waits for a frame: a batch holding pins must not wait for
+    //others to give theirs up.
+    pages.clear();
+    page_end.clear();
+    batch.clear();
+    while (first < n && pages.size() < window) {
+      int page_id = writes[order[first]].page_id;
+      int i = pinFrame(page_id, pages.empty());
+      if (i == ALL_PINNED)
+	break;
+      if (i == -1)
+	throw out_of_range("StorageEngine::write");
+      pages.push_back(guardFrame(i));
+      //check them all first, as updateFrame would, as the page grows
+      unsigned length = pages.back().length();
+      for (; first < n && writes[order[first]].page_id == page_id; ++first) {
+	const PageWrite& w = writes[order[first]];
+	if (w.offset < 0 || (unsigned)w.offset > length || w.offset + w.length > capacity)
+	  throw out_of_range("StorageEngine::write");
+	length = max<unsigned>(length, w.offset + w.length);
+	batch.push_back(w);
+      }
+      page_end.push_back(batch.size());
+    }
+    //apply them, keeping what each overwrote for its update record
+    old_lengths.resize(pages.size());
+    was_dirty.resize(pages.size());
+    olds.resize(batch.size());
+    for (size_t p = 0, k = 0; p < pages.size(); ++p) {
+      int i = pages[p].frame();
+      old_lengths[p] = pages[p].length();
+      was_dirty[p] = records.frame(i).dirty;
+      for (; k < page_end[p]; ++k) {
+	zeroFrame(i, batch[k].offset, batch[k].length);
+	olds[k].assign(pages[p].data() + batch[k].offset, batch[k].length);
+	updateFrame(i, batch[k].offset, batch[k].data, batch[k].length);
+      }
+    }
+    int first_lsn;
+    try {
+      first_lsn = lm_ptr->write(txid, batch.data(), olds.data(), batch.size());
+    } catch (...) {
+      //nothing was logged: put the pages back as they were
+      for (size_t p = pages.size(), k = batch.size(); p-- > 0; ) {
+	for (; k > (p ? page_end[p - 1] : 0); --k)
+	  memcpy(pages[p].data() + batch[k - 1].offset, olds[k - 1].data(), olds[k - 1].length());
+	records.frame(pages[p].frame()).length = old_lengths[p];
+	records.frame(pages[p].frame()).dirty = was_dirty[p];
+      }
+      throw;
+    }
+    //a page ends at the LSN of its last write
+    for (size_t p = 0; p < pages.size(); ++p)
+      pages[p].setPageLSN(first_lsn + (int)page_end[p] - 1);
+  }
 }
 
 void StorageEngine::abort(int txid, int pages_allowed){
@@ -138,20 +314,124 @@ void StorageEngine::abort(int txid, int pages_allowed){
  * Increments the log_sequence_number by 1 and returns it.
  */
 int StorageEngine::nextLSN() {
-  ++log_sequence_number;
-  return log_sequence_number;
+  return ++log_sequence_number;
 }
 
+/*
+ * The control file: the master record, where it is, and a crc of it all.
+ */
+struct ControlFile {
+  uint32_t magic;
+  int32_t master_lsn;
+  uint32_t format;
+  uint32_t segment;
+  uint64_t offset;
+  uint32_t unused;
+  uint32_t crc; //of the bytes before it
+};
+
+static const uint32_t CONTROL_MAGIC = 0x4c525443; //"CTRL"
+
 /*
  * store_master(int lsn)
  *
  * Writes lsn to a particular location on the disk, returns true on success.
  */
-bool StorageEngine::store_master(int lsn) {
+bool StorageEngine::store_master(int lsn, LogPosition at) {
     master_lsn = lsn;
+    ControlFile ctl;
+    memset(&ctl, 0, sizeof(ctl));
+    ctl.magic = CONTROL_MAGIC;
+    ctl.master_lsn = lsn;
+    ctl.format = log_format;
+    ctl.segment = at.segment;
+    ctl.offset = at.offset;
+    ctl.crc = crc32(&ctl, offsetof(ControlFile, crc));
+    string name = log_filename + ".ctl";
+    string tmp = name + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+      return false;
+    bool ok = ::write(fd, &ctl, sizeof(ctl)) == sizeof(ctl) && fsync(fd) == 0;
+    ::close(fd);
+    if (!ok || rename(tmp.c_str(), name.c_str()) == -1)
+      return false;
+    //and the rename itself
+    size_t slash = name.rfind('/');
+    int dir = ::open(slash == string::npos ? "." : name.substr(0, slash).c_str(), O_RDONLY);
+    if (dir != -1) {
+      fsync(dir);
+      ::close(dir);
+    }
     return true;
 }
 
+/*
+ * Takes the master record back from the control file, unless the
+ * file is missing, torn, or points at something that is not the
+ * begin_checkpoint it names.
+ */
+void StorageEngine::loadMaster() {
+  master_lsn = -1;
+  ControlFile ctl;
+  ifstream input(log_filename + ".ctl", ios::binary);
+  if (!input.read((char*)&ctl, sizeof(ctl)))
+    return;
+  if (ctl.magic != CONTROL_MAGIC || ctl.crc != crc32(&ctl, offsetof(ControlFile, crc))
+      || ctl.format != (uint32_t)log_format)
+    return;
+  LogPosition at;
+  at.segment = ctl.segment;
+  at.offset = ctl.offset;
+  if (isCheckpointAt(ctl.master_lsn, at))
+    master_lsn = ctl.master_lsn;
+}
+
+bool StorageEngine::isCheckpointAt(int lsn, LogPosition at) {
+  string name = log_writer.getSegmentSize() ? log_writer.segmentName(at.segment) : log_filename;
+  ifstream input(name, ios::binary);
+  if (log_format == BINARY_LOG) {
+    char file_header[LOG_FILE_HEADER_SIZE];
+    if (!input.read(file_header, sizeof(file_header)))
+      return false;
+    input.seekg(0, ios::end);
+    uint64_t size = input.tellg();
+    input.seekg(at.offset);
+    if (!isFramedLog(file_header, sizeof(file_header))) {
+      BinaryLogHeader h;
+      return input.read((char*)&h, sizeof(h)) && h.lsn == lsn && h.type == BEGIN_CKPT;
+    }
+    //at is the frame the record is in
+    LogFrameHeader h;
+    if (!input.read((char*)&h, sizeof(h)) || h.packed_length > size - at.offset)
+      return false;
+    string frame((const char*)&h, sizeof(h));
+    frame.resize(sizeof(h) + h.packed_length);
+    string recs;
+    if (!input.read(&frame[sizeof(h)], h.packed_length) || !parseFrame(frame.data(), frame.size(), h)
+	|| !unpackFrame(frame.data(), h, recs))
+      return false;
+    LogRecordView view;
+    for (size_t pos = 0; view.parse(recs.data() + pos, recs.size() - pos); pos += view.length()) {
+      if (view.getLSN() == lsn)
+	return view.getType() == BEGIN_CKPT;
+    }
+    return false;
+  }
+  input.seekg(at.offset);
+  string line, type;
+  int record_lsn, prevLSN, txid;
+  if (!getline(input, line))
+    return false;
+  istringstream fields(line);
+  return fields >> record_lsn >> prevLSN >> txid >> type && record_lsn == lsn
+    && type == "begin_checkpoint";
+}
+
+LogPosition StorageEngine::logPosition(size_t ahead) {
+  return log_writer.position(ahead);
+}
+
 /*
  * get_master()
  *
@@ -162,12 +442,88 @@ int StorageEngine::get_master() {
 }
 
 
+/*
+ * Returns the buffer pool hit/miss/eviction counters.
+ */
+BufferPoolStats StorageEngine::getBufferStats() {
+  return records.getStats();
+}
+
+bool StorageEngine::cleanPage(int page_id) {
+  int i;
+  {
+    unique_lock<recursive_mutex> pool(pool_mutex);
+    while ((i = records.peek(page_id)) != -1 && records.frame(i).loading)
+      frame_loaded.wait(pool);
+    if (i == -1) {
+      //before it can be read in and dirtied again
+      lm_ptr->pageCleaned(page_id);
+      return false;
+    }
+    records.pin(i);
+  }
+  //exclusive, like an eviction: no writer may dirty it again until
+  //the LogMgr has been told it is clean
+  PageGuard page = guardFrame(i);
+  Frame& f = records.frame(i);
+  bool wrote = f.dirty;
+  if (f.dirty) {
+    lock_guard<recursive_mutex> pool(pool_mutex);
+    lm_ptr->pageFlushed(page_id);
+    if (!onDisk->writePage(page_id, f.pageLSN, page.data(), f.length))
+      throw runtime_error("StorageEngine: cannot write page " + to_string(page_id));
+    f.dirty = false;
+    records.countDirtyFlush();
+  }
+  lm_ptr->pageCleaned(page_id);
+  return wrote;
+}
+
+unsigned StorageEngine::frameCount() {
+  return records.size();
+}
+
+unsigned StorageEngine::dirtyFrames() {
+  unsigned dirty = 0;
+  for (unsigned i = 0; i < records.size(); ++i) {
+    {
+      lock_guard<recursive_mutex> pool(pool_mutex);
+      //a page being read in is not dirty yet
+      if (records.frame(i).page_id == -1 || records.frame(i).loading)
+	continue;
+      records.pin(i);
+    }
+    records.latch(i).lockShared();
+    if (records.frame(i).dirty)
+      ++dirty;
+    records.latch(i).unlockShared();
+    unpinFrame(i);
+  }
+  return dirty;
+}
+
+int StorageEngine::currentLSN() {
+  return log_sequence_number;
+}
+
+int StorageEngine::pageCount() {
+  return onDisk->pageCount();
+}
+
 /* 
 * Returns the LSN of a page.
 */
 int StorageEngine::getLSN(int page_id) {
-  int i = findPage(page_id);
-  return records[i].pageLSN;
+  //recursive when an eviction asks, but then the page is resident
+  unique_lock<recursive_mutex> pool(pool_mutex);
+  //a resident page is only peeked at, so write-back asking for its
+  //LSN neither counts a hit nor makes it look recently used; a page
+  //read ahead still goes through findPage, which lets go of its pin
+  int i = records.peek(page_id);
+  if (i != -1 && !records.frame(i).loading && !records.frame(i).prefetched)
+    return records.frame(i).pageLSN;
+  i = waitForFrame(pool, page_id);
+  return records.frame(i).pageLSN;
 }
 
 /*
@@ -177,13 +533,65 @@ string StorageEngine::getOutputFileName() {
   return output_filename;
 }
 
+/*
+ * Return the name of the log file
+ */
+string StorageEngine::getLogFileName() {
+  return log_filename;
+}
+
+string StorageEngine::getLogFileName(int lsn) {
+  if (!log_writer.getSegmentSize())
+    return log_filename;
+  unsigned first = log_writer.firstSegment();
+  unsigned n = log_writer.lastSegment();
+  while (n > first) {
+    int start = segmentFirstLSN(n);
+    if (start != -1 && start <= lsn)
+      break;
+    --n;
+  }
+  return log_writer.segmentName(n);
+}
+
 /* 
 * Returns as much of the log as is on disk
 */
 string StorageEngine::getLog() {
 //read the file [log_filename] in as a string, and return that.
     string wholefile, tmp;
+
+    if (log_writer.getSegmentSize()) {
+      //the segments back to back; a binary log keeps one file header
+      unsigned last = log_writer.lastSegment();
+      for (unsigned n = log_writer.firstSegment(); n <= last; ++n) {
+	ifstream input(log_writer.segmentName(n), ios::binary);
+	string part((istreambuf_iterator<char>(input)), istreambuf_iterator<char>());
+	if (log_format == BINARY_LOG)
+	  part = unframeLog(part);
+	if (log_format == BINARY_LOG && !wholefile.empty() && isBinaryLog(part.data(), part.size()))
+	  part.erase(0, LOG_FILE_HEADER_SIZE);
+	wholefile += part;
+      }
+      if (log_format == BINARY_LOG)
+	return wholefile;
+      istringstream lines(wholefile);
+      wholefile.clear();
+      while (getline(lines, tmp)) {
+	if (tmp != "") {
+	  wholefile += tmp;
+	  wholefile += "\n";
+	}
+      }
+      return wholefile;
+    }
     
+    if (log_format == BINARY_LOG) {
+      ifstream input(log_filename, ios::binary);
+      wholefile.assign(istreambuf_iterator<char>(input), istreambuf_iterator<char>());
+      return unframeLog(wholefile);
+    }
+
     ifstream input(log_filename);
     
     while(!input.eof()) {
@@ -205,72 +613,432 @@ string StorageEngine::getLog() {
 * returns false and doesn't write the page. 
 */
 bool StorageEngine::pageWrite(int page_id, int offset, string text, int lsn) {
-  if (page_writes_permitted <= 0) 
+  if (!takePageWrite())
+    return false;
+  return restartWrite(page_id, offset, text, lsn);
+}
+
+bool StorageEngine::restartWrite(int page_id, int offset, const string& text, int lsn) {
+  return changePage(page_id, lsn, [&](int i) { updateFrame(i, offset, text); });
+}
+
+bool StorageEngine::pageRedo(const LogRecordView& rec, bool budgeted) {
+  if (budgeted && !takePageWrite())
+    return false;
+  return changePage(rec.getPageID(), rec.getLSN(), [&](int i) { redoFrame(i, rec); });
+}
+
+bool StorageEngine::pageRedo(PageGuard& page, const LogRecordView& rec, bool budgeted) {
+  if (budgeted && !takePageWrite())
+    return false;
+  redoFrame(page.frame(), rec);
+  page.setPageLSN(rec.getLSN());
+  return true;
+}
+
+bool StorageEngine::pageUndo(const LogRecordView& update, int lsn, bool budgeted) {
+  if (budgeted && !takePageWrite())
+    return false;
+  return changePage(update.getPageID(), lsn, [&](int i) {
+    if (update.isDelta()) {
+      deltaFrame(i, update.getOffset(), update.getDeltaRange(), update.getDelta());
+    } else {
+      ImageRef before = update.getBeforeImage();
+      updateFrame(i, update.getOffset(), before.data, before.size);
+    }
+  });
+}
+
+/*
+ * Takes one write from the budget; gives it back if there was none.
+ */
+bool StorageEngine::takePageWrite() {
+  if (page_writes_permitted.fetch_sub(1) <= 0) {
+    ++page_writes_permitted;
     return false;
-  --page_writes_permitted;
-  updatePage(page_id, offset, text);
-  updateLSN(page_id, lsn);
+  }
   return true;
 }
 
+/*
+ * Runs change on the latched frame of page_id and sets its pageLSN.
+ */
+bool StorageEngine::changePage(int page_id, int lsn, const function<void(int)>& change) {
+  PageGuard page = pinPage(page_id);
+  if (!page.valid())
+    throw out_of_range("StorageEngine::pageWrite");
+  change(page.frame());
+  page.setPageLSN(lsn);
+  return true;
+}
+
+PageGuard StorageEngine::pinPage(int page_id) {
+  int i = pinFrame(page_id, true);
+  if (i == -1)
+    return PageGuard();
+  return guardFrame(i);
+}
+
+int StorageEngine::getPageWritesPermitted() {
+  return page_writes_permitted;
+}
+
 
 //private
 
 /* 
- * Returns the index of the specified page in the records vector.
- * If the desired page is not in the records vector, flushes some
- * other page from records to disk and reads the desired page
- * into records, then returns the index.
+ * Returns the frame of the specified page in the records buffer.
+ * If the desired page is not in the records buffer, flushes the
+ * replacement policy's victim to disk and reads the desired page
+ * into records, then returns the frame.
+ *
+ * return -1 if page not found in either records or onDisk, and
+ * ALL_PINNED if it is not in records and no frame can be given up.
+ * Throws runtime_error if the victim cannot be written, which leaves
+ * it dirty and resident, or the page cannot be read.
  *
- * return -1 if page not found in either records or onDisk
+ * Takes pool_mutex; the frame number stays valid only while the
+ * caller holds pool_mutex or a pin on the frame.
  */
 int StorageEngine::findPage(int page_id) {
-  if (page_id >= (int)onDisk.size()) //page does not exist
+  lock_guard<recursive_mutex> pool(pool_mutex);
+  if (page_id < 1 || page_id > onDisk->pageCount()) //page does not exist
     return -1;
 
-  for (unsigned i = 0; i < records.size(); ++i)
-      if (records[i].page_id == page_id)
-          return i;
+  int i = records.lookup(page_id);
+  if (i != -1) {
+    Frame& f = records.frame(i);
+    if (f.prefetched && !f.loading) {
+      //read ahead for this lookup: no need to hold it any more
+      f.prefetched = false;
+      --prefetched_frames;
+      unpinFrame(i);
+    }
+    return i;
+  }
 
   // If did not return, that means page not found inside records.
-  if (records.size() >= MEMORY_SIZE){
-    Page p = records.back();
-    int page_id = p.page_id;
-    flushPage(page_id); 
+  // The victim's frame is latched from its flush until the new page is
+  // in it, so nobody sees the frame half way. Being unpinned, nobody
+  // else holds its latch.
+  int v = -1;
+  if (records.full()) {
+    v = records.victim();
+    if (v == -1 && dropPrefetched())
+      v = records.victim();
+    if (v == -1)
+      return ALL_PINNED;
+    records.latch(v).lockExclusive();
+    try {
+      flushPage(records.frame(v).page_id);
+    } catch (...) {
+      records.latch(v).unlockExclusive();
+      throw;
+    }
+  }
+
+  i = records.insert(page_id);
+  if (i != v) {
+    if (v != -1)
+      records.latch(v).unlockExclusive();
+    records.latch(i).lockExclusive();
+  }
+  Frame& f = records.frame(i);
+  try {
+    if (!onDisk->readPage(page_id, f.pageLSN, records.data(i), f.length))
+      throw runtime_error("StorageEngine: cannot read page " + to_string(page_id));
+  } catch (...) {
+    //nobody may be handed what the frame holds now
+    records.evict(i);
+    records.latch(i).unlockExclusive();
+    throw;
+  }
+  try {
+    //whatever an instant restart has not redone on this page yet
+    lm_ptr->redoPage(page_id, [&](const LogRecordView& rec) {
+      if (f.pageLSN < rec.getLSN()) {
+	redoFrame(i, rec);
+	f.pageLSN = rec.getLSN();
+      }
+    });
+  } catch (...) {
+    records.latch(i).unlockExclusive();
+    throw;
+  }
+  records.latch(i).unlockExclusive();
+  return i;
+}
+
+/*
+ * findPage, but waits for a page an I/O thread is still reading in,
+ * and, if wait, while every frame is pinned. pool holds pool_mutex,
+ * and only once, or the waits could not let it go.
+ */
+int StorageEngine::waitForFrame(unique_lock<recursive_mutex>& pool, int page_id, bool wait) {
+  while (true) {
+    int i = findPage(page_id);
+    if (i == ALL_PINNED && wait)
+      frame_unpinned.wait(pool);
+    else if (i >= 0 && records.frame(i).loading)
+      frame_loaded.wait(pool);
+    else
+      return i;
   }
+}
 
-  records.push_back(onDisk[page_id-1]);
-  return (int)records.size()-1;
-  
+/*
+ * Pins the frame of page_id and returns it, or -1 if the page does
+ * not exist. Without wait, returns ALL_PINNED rather than waiting.
+ */
+int StorageEngine::pinFrame(int page_id, bool wait) {
+  unique_lock<recursive_mutex> pool(pool_mutex);
+  int i = waitForFrame(pool, page_id, wait);
+  if (i >= 0)
+    records.pin(i);
+  return i;
+}
+
+void StorageEngine::unpinFrame(int i) {
+  lock_guard<recursive_mutex> pool(pool_mutex);
+  records.unpin(i);
+  if (records.frame(i).pins == 0)
+    frame_unpinned.notify_all();
+}
+
+/*
+ * Latches frame i, already pinned, and hands both over to a guard.
+ * The latch is taken after pool_mutex is let go, so a writer waiting
+ * for a busy page does not hold up lookups of other pages.
+ */
+PageGuard StorageEngine::guardFrame(int i) {
+  records.latch(i).lockExclusive();
+  return PageGuard(this, i);
+}
+
+void PageGuard::release() noexcept {
+  if (!se)
+    return;
+  se->records.latch(i).unlockExclusive();
+  se->unpinFrame(i);
+  se = NULL;
 }
 
 /* 
- * updatePage(int page_id, int offset, string text)
+ * updateFrame(int i, int offset, string text)
  *
+ * Copies text into frame i; the caller holds its latch.
+ */
+void StorageEngine::updateFrame(int i, int offset, const char* text, size_t length) {
+  Frame& f = records.frame(i);
+  //same bounds as string::replace, except a page cannot outgrow its frame
+  unsigned capacity = onDisk->capacity() ? onDisk->capacity() : records.pageSize();
+  if (offset < 0 || (unsigned)offset > f.length || offset + length > capacity)
+    throw out_of_range("StorageEngine::updateFrame");
+  f.dirty = true;
+  //copy the specified text into the frame at the specified offset. 
+  memcpy(records.data(i) + offset, text, length);
+  if (offset + length > f.length)
+    f.length = offset + length;
+}
+
+/*
+ * XORs a delta into the frame. Bytes past the end of the page count
+ * as zeros, as they did when the delta was made (see write).
  */
-void StorageEngine::updatePage(int page_id, int offset, string text) {
-  int i = findPage(page_id);
-  records[i].dirty = true;
-  //update records[i].data to have the specified text at the specified offset. 
-  records[i].data.replace(offset, text.length(), text);
+void StorageEngine::deltaFrame(int i, int offset, size_t range, const ImageRef& delta) {
+  Frame& f = records.frame(i);
+  unsigned capacity = onDisk->capacity() ? onDisk->capacity() : records.pageSize();
+  if (offset < 0 || (unsigned)offset > f.length || offset + range > capacity)
+    throw out_of_range("StorageEngine::updateFrame");
+  zeroFrame(i, offset, range);
+  if (!applyDelta(records.data(i) + offset, range, delta))
+    throw runtime_error("StorageEngine: bad delta");
+  f.dirty = true;
+  if (offset + range > f.length)
+    f.length = offset + range;
+}
+
+void StorageEngine::redoFrame(int i, const LogRecordView& rec) {
+  if (rec.isDelta()) {
+    deltaFrame(i, rec.getOffset(), rec.getDeltaRange(), rec.getDelta());
+  } else {
+    ImageRef after = rec.getAfterImage();
+    updateFrame(i, rec.getOffset(), after.data, after.size);
+  }
+}
+
+/*
+ * Zeros whatever of length bytes at offset lies past the end of the
+ * page, where the frame still holds bytes of some earlier page.
+ */
+void StorageEngine::zeroFrame(int i, int offset, size_t length) {
+  Frame& f = records.frame(i);
+  size_t end = min<size_t>(offset + length, records.pageSize());
+  if (end > f.length)
+    memset(records.data(i) + f.length, 0, end - f.length);
 }
 
 void StorageEngine::flushPage(int page_id) {
   //If the page's dirty bit is true, set it false and update this page in onDisk, 
-  //Remove it from the records vector
-  for (unsigned i = 0; i < records.size(); ++i){
-    if (records[i].page_id == page_id) {
-      if (records[i].dirty){
-	records[i].dirty = false;
-	lm_ptr->pageFlushed(page_id);
-	onDisk[page_id-1] = records[i];
-      }
-      records.erase(records.begin() + i);
+  //Remove it from the records buffer
+  int i = records.peek(page_id);
+  if (i == -1)
+    return;
+  Frame& f = records.frame(i);
+  if (f.dirty && write_run > 1) {
+    writeRun(page_id);
+  } else if (f.dirty){
+    lm_ptr->pageFlushed(page_id);
+    //a page that did not reach the disk stays dirty and resident
+    if (!onDisk->writePage(page_id, f.pageLSN, records.data(i), f.length))
+      throw runtime_error("StorageEngine: cannot write page " + to_string(page_id));
+    f.dirty = false;
+    records.countDirtyFlush();
+  }
+  records.evict(i);
+}
+
+/*
+ * A dirty resident page nobody holds, whose bytes can be written out
+ * from under pool_mutex alone.
+ */
+bool StorageEngine::canJoinRun(int page_id) {
+  if (page_id < 1 || page_id > onDisk->pageCount())
+    return false;
+  int i = records.peek(page_id);
+  return i != -1 && records.frame(i).dirty && records.frame(i).pins == 0;
+}
+
+/*
+ * Writes dirty page page_id, and the dirty pages around it that
+ * canJoinRun, up to write_run pages, with one writePages call.
+ * They are clean afterwards, or still dirty if it throws
+ * runtime_error. The caller holds pool_mutex.
+ */
+void StorageEngine::writeRun(int page_id) {
+  int first = page_id;
+  int last = page_id;
+  while ((unsigned)(last - first + 1) < write_run && canJoinRun(first - 1))
+    --first;
+  while ((unsigned)(last - first + 1) < write_run && canJoinRun(last + 1))
+    ++last;
+  unsigned n = last - first + 1;
+  vector<int> lsns(n);
+  vector<const char*> bufs(n);
+  vector<unsigned> lengths(n);
+  for (unsigned k = 0; k < n; ++k) {
+    int i = records.peek(first + k);
+    Frame& f = records.frame(i);
+    lm_ptr->pageFlushed(first + k);
+    lsns[k] = f.pageLSN;
+    bufs[k] = records.data(i);
+    lengths[k] = f.length;
+  }
+  if (!onDisk->writePages(first, n, lsns.data(), bufs.data(), lengths.data()))
+    throw runtime_error("StorageEngine: cannot write pages " + to_string(first)
+			+ " to " + to_string(last));
+  for (unsigned k = 0; k < n; ++k) {
+    records.frame(records.peek(first + k)).dirty = false;
+    records.countDirtyFlush();
+  }
+  records.countCoalesced(n - 1);
+}
+
+/*
+ * Lets go of every page read ahead and not looked up yet, so their
+ * frames can be given up. Returns false if there were none.
+ * The caller holds pool_mutex.
+ */
+bool StorageEngine::dropPrefetched() {
+  bool dropped = false;
+  for (unsigned i = 0; i < records.size(); ++i) {
+    Frame& f = records.frame(i);
+    if (f.prefetched && !f.loading) {
+      f.prefetched = false;
+      --prefetched_frames;
+      records.unpin(i);
+      dropped = true;
     }
+  }
+  return dropped;
+}
+
+void StorageEngine::setIOThreads(unsigned threads) {
+  io.setThreads(threads);
+}
+
+void StorageEngine::setWriteCoalescing(unsigned pages) {
+  write_run = max(1u, pages);
+}
+
+void StorageEngine::prefetchPage(int page_id) {
+  if (!io.threads())
+    return;
+  lock_guard<recursive_mutex> pool(pool_mutex);
+  if (page_id < 1 || page_id > onDisk->pageCount() || records.peek(page_id) != -1
+      || prefetched_frames >= records.size() / 2)
+    return;
+  if (records.full()) {
+    //a hint does not take frames from pages someone was promised
+    int v = records.victim();
+    if (v == -1)
+      return;
+    records.latch(v).lockExclusive();
+    try {
+      flushPage(records.frame(v).page_id);
+    } catch (...) {
+      records.latch(v).unlockExclusive();
+      throw;
     }
+    records.latch(v).unlockExclusive();
+  }
+  int i = records.insert(page_id);
+  Frame& f = records.frame(i);
+  //one pin for the read, one until the page is looked up
+  f.loading = true;
+  f.prefetched = true;
+  records.pin(i);
+  records.pin(i);
+  ++prefetched_frames;
+  records.countPrefetch();
+  io.submit([this, i, page_id] { loadFrame(i, page_id); });
 }
 
-void StorageEngine::updateLSN(int page_id, int newLSN) {
-  int i = findPage(page_id);
-  records[i].pageLSN = newLSN;
+/*
+ * Runs on an I/O thread: reads page_id into frame i, which
+ * prefetchPage gave it, as findPage would. Everyone else waits for
+ * Frame::loading to clear before they use the frame. If the page
+ * cannot be read, its frame is given back, and whoever wants the
+ * page reads it again, and gets the error, through findPage.
+ */
+void StorageEngine::loadFrame(int i, int page_id) {
+  FrameLatch& latch = records.latch(i);
+  latch.lockExclusive();
+  Frame& f = records.frame(i);
+  bool loaded = true;
+  try {
+    if (!onDisk->readPage(page_id, f.pageLSN, records.data(i), f.length))
+      throw runtime_error("StorageEngine: cannot read page " + to_string(page_id));
+    lm_ptr->redoPage(page_id, [&](const LogRecordView& rec) {
+      if (f.pageLSN < rec.getLSN()) {
+	redoFrame(i, rec);
+	f.pageLSN = rec.getLSN();
+      }
+    });
+  } catch (...) {
+    loaded = false;
+  }
+  lock_guard<recursive_mutex> pool(pool_mutex);
+  if (loaded) {
+    f.loading = false;
+    records.unpin(i);
+  } else {
+    //only its two pins are on it, anyone else waits for the load
+    --prefetched_frames;
+    records.evict(i);
+  }
+  latch.unlockExclusive();
+  frame_loaded.notify_all();
+  //its frame may be the one a waiter for a victim can now have
+  frame_unpinned.notify_all();
 }
@@ -1,62 +1,160 @@
 #ifndef STORAGEENGINE_H_
 #define STORAGEENGINE_H_
 
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
 #include <string>
 #include <vector>
+#include "BufferPool.h"
+#include "IOPool.h"
+#include "PageStore.h"
+#include "LogWriter.h"
 
 class LogMgr; 
+class LogRecordView;
+class StorageEngine;
+struct ImageRef;
 
-struct Page {
-    int page_id; //equal to the line number where it's stored in the file. 
-    int pageLSN;
-    bool dirty;
-    std::string data;
-
-    Page() {
-        dirty = false;
-    }
-
-    Page(int new_page_id, int new_pageLSN, bool new_dirty, std::string new_data) {
-        page_id = new_page_id;
-        pageLSN = new_pageLSN;
-        dirty = new_dirty;
-        data = new_data;
-    }
+/*
+ * One write of a batch (see StorageEngine::write): length bytes at
+ * data go to page_id at offset. data must stay valid for the call.
+ */
+struct PageWrite {
+  int page_id;
+  int offset;
+  const char* data;
+  size_t length;
+};
+
+/*
+ * A page held in its buffer frame: pinned, so it is not evicted, and
+ * latched exclusively (see StorageEngine::pinPage). Its bytes and
+ * pageLSN are read and changed straight from the frame, without
+ * looking the page up again. Unlatched and unpinned when released or
+ * destroyed. Moves but does not copy.
+ */
+class PageGuard {
+ public:
+  PageGuard() : se(NULL), i(-1) {}
+  PageGuard(PageGuard&& other) noexcept : se(other.se), i(other.i) {other.se = NULL;}
+  PageGuard& operator=(PageGuard&& other) noexcept;
+  ~PageGuard() {release();}
+
+  /*
+   * False for a guard of no page: one pinPage could not find, moved
+   * from, or released.
+   */
+  bool valid() const {return se != NULL;}
+  int frame() const {return i;}
+  int pageID() const;
+  char* data();
+  unsigned length() const;
+  int pageLSN() const;
+  void setPageLSN(int lsn);
+
+  /*
+   * Unlatches and unpins the page now.
+   */
+  void release() noexcept;
+
+ private:
+  friend class StorageEngine;
+  PageGuard(StorageEngine* engine, int frame) : se(engine), i(frame) {}
+  PageGuard(const PageGuard&);
+  PageGuard& operator=(const PageGuard&);
+
+  StorageEngine* se;
+  int i;
 };
 
 class StorageEngine {
 
     private:
-        // Memory for records, when crash clear records.
-        std::vector<Page> records;
-	std::vector<Page> onDisk; 
-	int log_sequence_number = 1;
-        int master_lsn = -1;
+	PageStore* onDisk; //the disk, only touched through PageStore
+	const StorageBackendType BACKEND; //how page files are accessed
+	std::atomic<int> log_sequence_number{1};
+        std::atomic<int> master_lsn{-1};
 	//Number of pageWrite calls permitted.
 	//Must be 0 until a crash.
-	int page_writes_permitted = 0;
+	std::atomic<int> page_writes_permitted{0};
 	LogMgr* lm_ptr;
 	std::string log_filename;
+	LogWriter log_writer; //keeps log_filename open between forces
+	LogFormat log_format = TEXT_LOG;
+	bool log_compressed = false;
+	std::string log_archive_dir; //where truncated segments go, "" deletes them
+	int segmentFirstLSN(unsigned n);
+	void loadMaster();
+	bool isCheckpointAt(int lsn, LogPosition at);
         std::string output_filename;
 	const unsigned MEMORY_SIZE; //number of pages buffer can hold at once
+	const unsigned PAGE_SIZE; //bytes per buffer frame, 0 means fit the database
+        // Memory for records, when crash clear records.
+        BufferPool records;
+	// Guards the page -> frame mapping of records, the frames' pins,
+	// and onDisk. Recursive because an eviction calls
+	// LogMgr::pageFlushed, which reads the pageLSN back through getLSN.
+	// Nobody waits for the latch of a pinned frame while holding it.
+	std::recursive_mutex pool_mutex;
+	// Signalled when a frame's last pin goes.
+	std::condition_variable_any frame_unpinned;
+	// Signalled when an I/O thread is done reading a page in.
+	std::condition_variable_any frame_loaded;
+	static const int ALL_PINNED = -2;
 	int findPage(int page_id); 
-	void updatePage(int page_id, int offset, std::string text);
+	int waitForFrame(std::unique_lock<std::recursive_mutex>& pool, int page_id, bool wait = true);
+	int pinFrame(int page_id, bool wait);
+	void unpinFrame(int i);
+	PageGuard guardFrame(int i);
+	friend class PageGuard;
+	IOPool io; //reads pages ahead
+	unsigned prefetched_frames = 0; //frames with Frame::prefetched set
+	unsigned write_run = 1; //most dirty pages written back together
+	void loadFrame(int i, int page_id);
+	bool dropPrefetched();
+	bool canJoinRun(int page_id);
+	void writeRun(int page_id);
+	void updateFrame(int i, int offset, const char* text, size_t length);
+	void updateFrame(int i, int offset, const std::string& text) {
+	  updateFrame(i, offset, text.data(), text.length());
+	}
+	void deltaFrame(int i, int offset, size_t range, const ImageRef& delta);
+	void redoFrame(int i, const LogRecordView& rec);
+	void zeroFrame(int i, int offset, size_t length);
+	bool takePageWrite();
+	bool changePage(int page_id, int lsn, const std::function<void(int)>& change);
 	void flushPage(int page_id);
-	void updateLSN(int page_id, int newLSN);
 
     public:
         // Constructor
-        StorageEngine();
+        // memory_size is the number of buffer frames. page_size is the
+        // number of bytes each frame holds; 0 sizes the frames to the
+        // longest page of the database passed to start(). backend picks
+        // how a binary page file is accessed (see PageStore.h).
+        StorageEngine(unsigned memory_size = 10,
+                      ReplacementPolicyType policy = LAST_LOADED,
+                      unsigned page_size = 0,
+                      StorageBackendType backend = PREAD_BACKEND);
+        ~StorageEngine();
 
 	/* 
 	 * Starts the storage engine with a database by reading the database
-	 * from a file.
+	 * from a file. A text database is read into memory; a binary page
+	 * file (see PageFile.h) is opened in place and read on demand, so
+	 * starting costs the same whatever its size. Flushed pages are
+	 * written back into it, each after LogMgr::pageFlushed.
 	 * Also sets the associated LogMgr and the logfile name.
 	 */
 	void start(std::string db_filename, LogMgr* log_mgr_ptr, std::string testcase_num);
 
 	/*
 	 * Ends the test case, writing onDisk to actual disk.
+	 * For a page file, only pages flushed from the buffer were written,
+	 * so this just syncs and closes it; db_filename is not touched,
+	 * and dbconvert -t turns the page file into text. Throws
+	 * runtime_error if the sync fails. See PageStore::end.
 	 */
 	void end(std::string db_filename);
 
@@ -64,7 +162,7 @@ class StorageEngine {
 	 * Simulates a crash. 
 	 * Sets page_writes_permitted to safe_writes.
 	 * Replaces the old lm_ptr with log_mgr_ptr.
-	 * Empties the records vector (our page buffer).
+	 * Empties the records buffer (our page buffer).
 	 * Reads the log from log_entries
 	 * Calls lm_ptr ->recover()
 	 */
@@ -73,15 +171,120 @@ class StorageEngine {
 
 	/*
 	 * Appends the given string to the log file on disk.
+	 * Same as appendLog followed by forceLog.
 	 */
         void updateLog(std::string log_entries);
 
+	/*
+	 * Adds log_entries to the in-memory log buffer. They are lost
+	 * on a crash unless forceLog is called first.
+	 */
+        void appendLog(const std::string& log_entries);
+        void appendLog(const char* log_entries, size_t length);
+
+	/*
+	 * Writes the log buffer to the log file with a single write.
+	 * Throws runtime_error if it cannot be written or synced.
+	 */
+        void forceLog();
+
+	/*
+	 * If on, every forceLog also calls fdatasync on the log file.
+	 */
+        void setLogSync(bool on);
+
+	/*
+	 * Chooses how log records are encoded. Must be called before start().
+	 */
+        void setLogFormat(LogFormat format);
+        LogFormat getLogFormat();
+
+	/*
+	 * Compresses a binary log: every force writes one compressed
+	 * frame (see LogCodec.h) instead of the bare records. A frame
+	 * costs 16 bytes of header, so this pays off with forces of a
+	 * few hundred bytes or more (group commit, checkpoints, image
+	 * logging). Logs on disk are read either way. Off by default; a
+	 * text log is never compressed. Must be called before start().
+	 */
+        void setLogCompression(bool on);
+
+	/*
+	 * Splits the log into segment files of about bytes each (see
+	 * LogWriter::setSegmentSize); 0, the default, keeps one file.
+	 * truncateLog deletes old segments, or moves them into archive_dir
+	 * if one is given. Must be called before start().
+	 */
+        void setLogSegmentSize(size_t bytes, std::string archive_dir = "");
+
+	/*
+	 * Drops the oldest log segments for as long as every record in
+	 * them has an LSN below lsn. The segment being written is kept.
+	 * Does nothing for a log that is one file.
+	 */
+        void truncateLog(int lsn);
+
+	/*
+	 * Returns bytes written, number of forces and average force size.
+	 */
+        LogWriterStats getLogStats();
+
 	/*
 	 * Write to a page starting from the offset byte with the particular
 	 * transaction specified by txid.
+	 * Threads may call this concurrently for different transactions;
+	 * writes to the same page are serialized by its frame latch.
 	 */
         void write(int txid, int page_id, int offset, std::string input);
 
+	/*
+	 * Same as calling write for each of n writes in turn, but each
+	 * page is pinned and latched once for all its writes in the batch,
+	 * and nothing is copied but the bytes they overwrite. Pages are
+	 * taken in page_id order, up to half the buffer frames at a time;
+	 * the update records of each such window go into the logtail with
+	 * one reservation. Writes to the same page keep their order.
+	 * Throws out_of_range before anything in a window is written if
+	 * one of its writes does not fit.
+	 */
+        void write(int txid, const PageWrite* writes, size_t n);
+        void write(int txid, const std::vector<PageWrite>& writes) {
+	  write(txid, writes.data(), writes.size());
+	}
+
+	/*
+	 * Pins page_id in the buffer, reading it in if needed, and latches
+	 * it exclusively. If every frame is pinned, waits for one to be
+	 * released. The guard is not valid() if the page does not exist.
+	 * A thread holding a guard should release it before asking for
+	 * another: it may wait for a frame, or for a latch, forever.
+	 */
+	PageGuard pinPage(int page_id);
+
+	/*
+	 * Starts reading page_id into the buffer on an I/O thread, so a
+	 * later pinPage or getLSN finds it there. A hint only: nothing
+	 * happens without I/O threads, for a page that is resident or does
+	 * not exist, or when read-ahead already holds half the frames.
+	 * A prefetched page is pinned until it is first looked up, or
+	 * until a page needs its frame and no other one is free.
+	 */
+	void prefetchPage(int page_id);
+
+	/*
+	 * Number of I/O threads prefetchPage reads pages on; 0, the
+	 * default, turns read-ahead off.
+	 */
+	void setIOThreads(unsigned threads);
+
+	/*
+	 * When a dirty page is evicted, also writes back the dirty pages
+	 * next to it that nobody holds, up to pages in all, with one
+	 * PageStore::writePages call; they stay in the buffer, clean. 1,
+	 * the default, writes the evicted page alone.
+	 */
+	void setWriteCoalescing(unsigned pages);
+
 	/*
 	 * Sets the number of page writes allowed for this abort,
 	 * then calls LogMgr's abort function. 
@@ -90,24 +293,41 @@ class StorageEngine {
 
 	/*
 	 * Increments the log_sequence_number by 1 and returns it.
+	 * Atomic, so concurrent callers never get the same LSN.
 	 */
         int nextLSN();
 
 	/*
-	 * Writes lsn to a particular location on the disk.
+	 * Writes lsn, and where its record is in the log, to the control
+	 * file next to the log (the log file name followed by ".ctl").
+	 * The new contents go to a temporary file that is synced and then
+	 * renamed over the old one, so a crash leaves one or the other.
 	 * Returns true on success.
 	 */
-	bool store_master(int lsn);
+	bool store_master(int lsn, LogPosition at = LogPosition());
 
 	/*
 	 * Gets lsn from a particular location on the disk
-	 * (where store_master wrote it)
+	 * (where store_master wrote it). start() reads the control file
+	 * back, if its checksum holds and its record is in the log.
 	 */
         int get_master();
+
+	/*
+	 * Where a record appended after ahead more bytes will be (see
+	 * LogWriter::position).
+	 */
+        LogPosition logPosition(size_t ahead = 0);
         
 
+	/*
+	 * Number of pages in the database; page ids run from 1.
+	 */
+        int pageCount();
+
 	/* 
-	 * Returns the LSN of a page.
+	 * Returns the LSN of a page. Reading it in counts as a miss; a
+	 * page already in the buffer is not counted as used at all.
 	 */
         int getLSN(int page_id);
 
@@ -118,15 +338,98 @@ class StorageEngine {
 
 	/* 
 	 * Returns as much of the log as is on disk
+	 * (the raw bytes, file header included, for a binary log).
+	 * A segmented log is read from its oldest remaining segment.
 	 */
         std::string getLog();
 
+	/*
+	 * Returns the name of the log file, for reading it record by record
+	 */
+        std::string getLogFileName();
+
+	/*
+	 * Returns the file holding the record with this LSN: the log file,
+	 * or the segment it falls in.
+	 */
+        std::string getLogFileName(int lsn);
+
 	/*
 	* Writes to a page in memory, if allowed.  
 	* If page_writes_permitted <= 0, this just 
 	* returns false and doesn't write the page. 
 	*/
         bool pageWrite(int page_id, int offset, std::string text, int lsn);
+
+	/*
+	 * Same as pageWrite but not counted against page_writes_permitted:
+	 * for recovery work an instant restart does after recover() has
+	 * returned (see LogMgr::setInstantRestart).
+	 */
+        bool restartWrite(int page_id, int offset, const std::string& text, int lsn);
+
+	/*
+	 * Redoes an UPDATE or CLR on its page straight from the record,
+	 * with its after image or its delta; the pageLSN becomes the
+	 * record's LSN. budgeted counts it against page_writes_permitted
+	 * like pageWrite, otherwise it is like restartWrite.
+	 */
+        bool pageRedo(const LogRecordView& rec, bool budgeted = true);
+        bool pageRedo(PageGuard& page, const LogRecordView& rec, bool budgeted = true);
+
+	/*
+	 * Undoes an UPDATE on its page: writes back its before image, or
+	 * applies its delta again. The pageLSN becomes lsn.
+	 */
+        bool pageUndo(const LogRecordView& update, int lsn, bool budgeted = true);
+
+	/*
+	 * How many more pageWrite calls will succeed.
+	 */
+        int getPageWritesPermitted();
+
+	/*
+	 * Writes page_id back to disk if it is in the buffer and dirty,
+	 * without evicting it, logging first through LogMgr::pageFlushed.
+	 * Then tells the LogMgr the page is clean (LogMgr::pageCleaned);
+	 * a page not in the buffer was written when it was evicted.
+	 * Returns true if it wrote the page. Throws runtime_error, and
+	 * leaves the page dirty, if the write fails.
+	 */
+	bool cleanPage(int page_id);
+
+	/*
+	 * Number of buffer frames, and how many of them hold a page
+	 * changed since it was last written to disk.
+	 */
+	unsigned frameCount();
+	unsigned dirtyFrames();
+
+	/*
+	 * The LSN most recently handed out by nextLSN.
+	 */
+	int currentLSN();
+
+	/*
+	 * Returns the buffer pool hit/miss/eviction counters.
+	 */
+        BufferPoolStats getBufferStats();
 };
 
+inline PageGuard& PageGuard::operator=(PageGuard&& other) noexcept {
+  if (this != &other) {
+    release();
+    se = other.se;
+    i = other.i;
+    other.se = NULL;
+  }
+  return *this;
+}
+
+inline int PageGuard::pageID() const {return se->records.frame(i).page_id;}
+inline char* PageGuard::data() {return se->records.data(i);}
+inline unsigned PageGuard::length() const {return se->records.frame(i).length;}
+inline int PageGuard::pageLSN() const {return se->records.frame(i).pageLSN;}
+inline void PageGuard::setPageLSN(int lsn) {se->records.frame(i).pageLSN = lsn;}
+
 #endif
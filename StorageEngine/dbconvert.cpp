@@ -0,0 +1,32 @@
+#include "PageFile.h"
+#include <iostream>
+#include <string>
+#include <cstdlib>
+
+using namespace std;
+
+/*
+ * Converts a database between the text layout of sampleDBFile.txt and
+ * the binary page file format.
+ *
+ *   dbconvert.o -b text.db pages.db [page_size]   text -> page file
+ *   dbconvert.o -t pages.db text.db               page file -> text
+ */
+int main (int argc, char *argv[]) {
+  if (argc < 4) {
+    cerr << "usage: " << argv[0] << " -b text.db pages.db [page_size]" << endl
+	 << "       " << argv[0] << " -t pages.db text.db" << endl;
+    return 2;
+  }
+  string mode = argv[1];
+  bool ok = false;
+  if (mode == "-b")
+    ok = textToPageFile(argv[2], argv[3], argc > 4 ? atoi(argv[4]) : 0);
+  else if (mode == "-t")
+    ok = pageFileToText(argv[2], argv[3]);
+  if (!ok) {
+    cerr << argv[0] << ": cannot convert " << argv[2] << endl;
+    return 1;
+  }
+  return 0;
+}
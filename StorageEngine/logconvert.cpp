@@ -0,0 +1,76 @@
+#include "../StudentComponent/LogCodec.h"
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+using namespace std;
+
+static bool textToBinaryLog(string text_filename, string bin_filename) {
+  ifstream in(text_filename);
+  ofstream out(bin_filename, ios::binary | ios::trunc);
+  if (!in || !out)
+    return false;
+  string buf = binaryLogFileHeader();
+  string line;
+  while (getline(in, line)) {
+    if (line.empty())
+      continue;
+    LogRecord* lr = LogRecord::stringToRecordPtr(line);
+    encodeRecord(lr, buf);
+    delete lr;
+  }
+  out.write(buf.data(), buf.size());
+  return (bool)out;
+}
+
+static bool binaryToTextLog(string bin_filename, string text_filename) {
+  ifstream in(bin_filename, ios::binary);
+  if (!in)
+    return false;
+  string log((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+  log = unframeLog(log);
+  if (!isBinaryLog(log.data(), log.size()))
+    return false;
+  string text;
+  size_t pos = LOG_FILE_HEADER_SIZE;
+  LogRecordView view;
+  while (view.parse(log.data() + pos, log.size() - pos)) {
+    if (view.isDelta()) {
+      cerr << bin_filename << ": delta records have no text form" << endl;
+      return false;
+    }
+    formatText(view, text);
+    pos += view.length();
+  }
+  ofstream out(text_filename, ios::trunc);
+  out << text;
+  return (bool)out;
+}
+
+/*
+ * Converts a log between the text format and the binary format.
+ *
+ *   logconvert.o -b text.log bin.log    text -> binary
+ *   logconvert.o -t bin.log text.log    binary -> text
+ *
+ * A compressed binary log is read as well.
+ */
+int main (int argc, char *argv[]) {
+  if (argc < 4) {
+    cerr << "usage: " << argv[0] << " -b text.log bin.log" << endl
+	 << "       " << argv[0] << " -t bin.log text.log" << endl;
+    return 2;
+  }
+  string mode = argv[1];
+  bool ok = false;
+  if (mode == "-b")
+    ok = textToBinaryLog(argv[2], argv[3]);
+  else if (mode == "-t")
+    ok = binaryToTextLog(argv[2], argv[3]);
+  if (!ok) {
+    cerr << argv[0] << ": cannot convert " << argv[2] << endl;
+    return 1;
+  }
+  return 0;
+}
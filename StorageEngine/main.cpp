@@ -115,6 +115,10 @@ void runTestcase(string filename) {
  * 
  */
 int main (int argc, char *argv[]) {
+    if (argc < 2) {
+        cerr << "usage: " << argv[0] << " testcase" << endl;
+        return 2;
+    }
     runTestcase(argv[1]);
 
     return 0;
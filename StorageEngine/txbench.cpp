@@ -0,0 +1,98 @@
+#include "StorageEngine.h"
+#include "../StudentComponent/LogMgr.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/*
+ * Runs transactions from several threads against one StorageEngine and
+ * reports the throughput, to see how write scales with threads.
+ *
+ *   txbench.o db threads [txs_per_thread] [writes_per_tx] [frames] [ckpt_bytes] [batch] [write_run]
+ *
+ * Each thread runs its own transactions, which write to random pages
+ * and then commit. With ckpt_bytes, a background checkpoint is taken
+ * every ckpt_bytes of log. With batch 1, a transaction hands all its
+ * writes to StorageEngine in one batch. With write_run, an evicted
+ * dirty page is written back together with up to write_run - 1 dirty
+ * pages next to it (see StorageEngine::setWriteCoalescing). The log
+ * goes to output/log/logbench.log. The run ends without
+ * StorageEngine::end, so a text database is left as it was; a page
+ * file keeps the pages that were flushed during the run.
+ */
+int main (int argc, char *argv[]) {
+  if (argc < 3) {
+    cerr << "usage: " << argv[0]
+	 << " db threads [txs_per_thread] [writes_per_tx] [frames] [ckpt_bytes] [batch] [write_run]" << endl;
+    return 2;
+  }
+  string db_filename = argv[1];
+  int threads = atoi(argv[2]);
+  int txs = argc > 3 ? atoi(argv[3]) : 1000;
+  int writes = argc > 4 ? atoi(argv[4]) : 10;
+  unsigned frames = argc > 5 ? atoi(argv[5]) : 10;
+  size_t ckpt_bytes = argc > 6 ? atol(argv[6]) : 0;
+  bool batch = argc > 7 && atoi(argv[7]);
+  unsigned write_run = argc > 8 ? atoi(argv[8]) : 1;
+
+  StorageEngine se(frames);
+  se.setWriteCoalescing(write_run);
+  LogMgr lm;
+  lm.setStorageEngine(&se);
+  remove("output/log/logbench.log");
+  se.start(db_filename, &lm, "bench");
+  if (ckpt_bytes)
+    lm.enableAutoCheckpoint(ckpt_bytes, 0);
+  int pages = se.pageCount();
+  if (pages == 0) {
+    cerr << argv[0] << ": " << db_filename << " has no pages" << endl;
+    return 1;
+  }
+
+  chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+  vector<thread> workers;
+  for (int t = 0; t < threads; ++t) {
+    workers.push_back(thread([&, t]() {
+      mt19937 rng(t + 1);
+      vector<PageWrite> ws;
+      for (int i = 0; i < txs; ++i) {
+	int txid = t * txs + i + 1;
+	string text = to_string(txid % 10);
+	ws.clear();
+	for (int w = 0; w < writes; ++w) {
+	  int page_id = rng() % pages + 1;
+	  if (!batch) {
+	    se.write(txid, page_id, 0, text);
+	    continue;
+	  }
+	  PageWrite pw = {page_id, 0, text.data(), text.size()};
+	  ws.push_back(pw);
+	}
+	if (batch)
+	  se.write(txid, ws);
+	lm.commit(txid);
+      }
+    }));
+  }
+  for (unsigned t = 0; t < workers.size(); ++t)
+    workers[t].join();
+  double secs = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+  long total = (long)threads * txs * writes;
+  LogWriterStats ls = se.getLogStats();
+  BufferPoolStats bs = se.getBufferStats();
+  cout << threads << " threads, " << total << " writes in " << secs << " s: "
+       << (long)(total / secs) << " writes/s" << endl
+       << "log: " << ls.flushes << " forces, " << ls.averageFlushSize()
+       << " bytes each; buffer: " << bs.hits << " hits, " << bs.misses
+       << " misses, " << bs.dirty_flushes << " dirty pages written in "
+       << bs.dirty_flushes - bs.coalesced << " writes" << endl;
+  return 0;
+}
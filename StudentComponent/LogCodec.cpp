@@ -0,0 +1,580 @@
+#include "LogCodec.h"
+#include "../StorageEngine/Checksum.h"
+#include "../StorageEngine/Compress.h"
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+bool isBinaryLog(const char* buf, size_t len) {
+  return len >= sizeof(LOG_FILE_MAGIC) &&
+    memcmp(buf, LOG_FILE_MAGIC, sizeof(LOG_FILE_MAGIC)) == 0;
+}
+
+bool isFramedLog(const char* buf, size_t len) {
+  uint32_t version;
+  if (len < LOG_FILE_HEADER_SIZE || !isBinaryLog(buf, len))
+    return false;
+  memcpy(&version, buf + sizeof(LOG_FILE_MAGIC), sizeof(version));
+  return version == LOG_FORMAT_FRAMED;
+}
+
+string binaryLogFileHeader(bool framed) {
+  string header(LOG_FILE_MAGIC, sizeof(LOG_FILE_MAGIC));
+  uint32_t version = framed ? LOG_FORMAT_FRAMED : LOG_FORMAT_VERSION;
+  header.append((const char*)&version, sizeof(version));
+  return header;
+}
+
+///////////////////  LogRecordView  ///////////////////
+
+int32_t LogRecordView::field(size_t at) const {
+  int32_t v;
+  memcpy(&v, rec + at, sizeof(v));
+  return v;
+}
+
+static uint32_t recordCrc(const char* rec, size_t len) {
+  const size_t crc_at = offsetof(BinaryLogHeader, crc);
+  uint32_t zero = 0;
+  uint32_t crc = crc32(rec, crc_at);
+  crc = crc32(&zero, sizeof(zero), crc);
+  return crc32(rec + crc_at + sizeof(zero), len - crc_at - sizeof(zero), crc);
+}
+
+LogRecordView::LogRecordView(const char* buf) : rec(buf) {
+  uint32_t length;
+  memcpy(&length, buf + offsetof(BinaryLogHeader, length), sizeof(length));
+  len = length;
+}
+
+bool LogRecordView::parse(const char* buf, size_t avail) {
+  rec = NULL;
+  len = 0;
+  if (avail < sizeof(BinaryLogHeader))
+    return false;
+  BinaryLogHeader h;
+  memcpy(&h, buf, sizeof(h));
+  TxType type = (TxType)(h.type & ~RECORD_DELTA);
+  if (h.length < sizeof(BinaryLogHeader) || h.length > avail || type > END_CKPT)
+    return false;
+  if ((h.type & RECORD_DELTA) && type != UPDATE && type != CLR && type != END_CKPT)
+    return false;
+  if (h.crc != recordCrc(buf, h.length))
+    return false;
+  rec = buf;
+  len = h.length;
+  if (payloadEnd() > len) {
+    rec = NULL;
+    len = 0;
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Where the payload ends according to its own length fields.
+ * Every read stays inside the record if this fits in len.
+ */
+size_t LogRecordView::payloadEnd() const {
+  size_t at = sizeof(BinaryLogHeader);
+  if (isDelta() && getType() != END_CKPT) {
+    at = deltaAt() + 4;
+    if (at + 4 > len) return at + 4;
+    return at + 4 + (uint32_t)field(at);
+  }
+  switch (getType()) {
+  case UPDATE:
+    at += 8;
+    if (at + 4 > len) return at + 4;
+    at += 4 + (uint32_t)field(at);
+    if (at + 4 > len) return at + 4;
+    return at + 4 + (uint32_t)field(at);
+  case CLR:
+    at += 12;
+    if (at + 4 > len) return at + 4;
+    return at + 4 + (uint32_t)field(at);
+  case END_CKPT:
+    if (at + 4 > len) return at + 4;
+    at += 4 + (size_t)(uint32_t)field(at) * 12;
+    if (at + 4 > len) return at + 4;
+    at += 4 + (size_t)(uint32_t)field(at) * 8;
+    if (!isDelta()) return at;
+    at += 4;
+    if (at + 4 > len) return at + 4;
+    at += 4 + (size_t)(uint32_t)field(at) * 4;
+    if (at + 4 > len) return at + 4;
+    return at + 4 + (size_t)(uint32_t)field(at) * 4;
+  default:
+    return at;
+  }
+}
+
+ImageRef LogRecordView::getBeforeImage() const {
+  size_t at = sizeof(BinaryLogHeader) + 8;
+  ImageRef img = {rec + at + 4, (size_t)field(at)};
+  return img;
+}
+
+ImageRef LogRecordView::getAfterImage() const {
+  size_t at = sizeof(BinaryLogHeader) + 8;
+  if (getType() == CLR)
+    at += 4;
+  else
+    at += 4 + field(at);
+  ImageRef img = {rec + at + 4, (size_t)field(at)};
+  return img;
+}
+
+ImageRef LogRecordView::getDelta() const {
+  size_t at = deltaAt() + 4;
+  ImageRef delta = {rec + at + 4, (size_t)(uint32_t)field(at)};
+  return delta;
+}
+
+void LogRecordView::txEntry(int i, int& txid, int& lastLSN, TxStatus& status) const {
+  size_t at = sizeof(BinaryLogHeader) + 4 + i * 12;
+  txid = field(at);
+  lastLSN = field(at + 4);
+  status = (TxStatus)field(at + 8);
+}
+
+int LogRecordView::dirtyPageCount() const {
+  return field(sizeof(BinaryLogHeader) + 4 + txCount() * 12);
+}
+
+void LogRecordView::dirtyPageEntry(int i, int& page_id, int& recLSN) const {
+  size_t at = sizeof(BinaryLogHeader) + 8 + txCount() * 12 + i * 8;
+  page_id = field(at);
+  recLSN = field(at + 4);
+}
+
+/////////////////// End LogRecordView  ///////////////////
+
+static void putInt(string& out, int32_t v) {
+  out.append((const char*)&v, sizeof(v));
+}
+
+static void putImage(string& out, ImageRef img) {
+  putInt(out, img.size);
+  out.append(img.data, img.size);
+}
+
+/*
+ * Writes the header of a record whose payload follows; finishRecord
+ * fills in the length once the payload is there.
+ */
+static size_t startRecord(string& out, int lsn, int prevLSN, int txID, TxType type) {
+  size_t start = out.size();
+  BinaryLogHeader h;
+  h.length = 0;
+  h.type = type;
+  h.lsn = lsn;
+  h.prevLSN = prevLSN;
+  h.txID = txID;
+  h.crc = 0;
+  out.append((const char*)&h, sizeof(h));
+  return start;
+}
+
+static void setDeltaFlag(string& out, size_t start) {
+  uint32_t type;
+  memcpy(&type, &out[start] + offsetof(BinaryLogHeader, type), sizeof(type));
+  type |= RECORD_DELTA;
+  memcpy(&out[start] + offsetof(BinaryLogHeader, type), &type, sizeof(type));
+}
+
+static void finishRecord(string& out, size_t start) {
+  uint32_t length = out.size() - start;
+  memcpy(&out[start] + offsetof(BinaryLogHeader, length), &length, sizeof(length));
+}
+
+void appendRecord(string& out, int lsn, int prevLSN, int txID, TxType type) {
+  finishRecord(out, startRecord(out, lsn, prevLSN, txID, type));
+}
+
+void appendUpdate(string& out, int lsn, int prevLSN, int txID,
+		  int page_id, int offset, ImageRef before, ImageRef after) {
+  size_t start = startRecord(out, lsn, prevLSN, txID, UPDATE);
+  putInt(out, page_id);
+  putInt(out, offset);
+  putImage(out, before);
+  putImage(out, after);
+  finishRecord(out, start);
+}
+
+void appendCLR(string& out, int lsn, int prevLSN, int txID,
+	       int page_id, int offset, ImageRef after, int undoNextLSN) {
+  size_t start = startRecord(out, lsn, prevLSN, txID, CLR);
+  putInt(out, page_id);
+  putInt(out, offset);
+  putInt(out, undoNextLSN);
+  putImage(out, after);
+  finishRecord(out, start);
+}
+
+void appendDeltaUpdate(string& out, int lsn, int prevLSN, int txID,
+		       int page_id, int offset, ImageRef before, ImageRef after) {
+  size_t start = startRecord(out, lsn, prevLSN, txID, UPDATE);
+  setDeltaFlag(out, start);
+  putInt(out, page_id);
+  putInt(out, offset);
+  putInt(out, after.size);
+  size_t length_at = out.size();
+  putInt(out, 0);
+  appendDelta(out, before, after);
+  int32_t length = out.size() - length_at - 4;
+  memcpy(&out[length_at], &length, sizeof(length));
+  finishRecord(out, start);
+}
+
+void appendDeltaCLR(string& out, int lsn, int prevLSN, int txID,
+		    int page_id, int offset, size_t range, ImageRef delta, int undoNextLSN) {
+  size_t start = startRecord(out, lsn, prevLSN, txID, CLR);
+  setDeltaFlag(out, start);
+  putInt(out, page_id);
+  putInt(out, offset);
+  putInt(out, undoNextLSN);
+  putInt(out, range);
+  putImage(out, delta);
+  finishRecord(out, start);
+}
+
+void appendDelta(string& out, ImageRef before, ImageRef after) {
+  const unsigned char* b = (const unsigned char*)before.data;
+  const unsigned char* a = (const unsigned char*)after.data;
+  size_t n = after.size;
+  size_t literal = 0; //where the pending literal run starts
+  size_t i = 0;
+  while (i < n) {
+    unsigned char x = b[i] ^ a[i];
+    size_t j = i + 1;
+    while (j < n && j - i < 130 && (unsigned char)(b[j] ^ a[j]) == x)
+      ++j;
+    if (j - i < 3) {
+      //too short to repeat; literal runs hold up to 128 bytes
+      i = j;
+      while (i - literal >= 128) {
+	out += (char)127;
+	for (size_t k = literal; k < literal + 128; ++k)
+	  out += (char)(b[k] ^ a[k]);
+	literal += 128;
+      }
+      continue;
+    }
+    if (i > literal) {
+      out += (char)(i - literal - 1);
+      for (size_t k = literal; k < i; ++k)
+	out += (char)(b[k] ^ a[k]);
+    }
+    out += (char)(0x80 + j - i - 3);
+    out += (char)x;
+    i = literal = j;
+  }
+  if (n > literal) {
+    out += (char)(n - literal - 1);
+    for (size_t k = literal; k < n; ++k)
+      out += (char)(b[k] ^ a[k]);
+  }
+}
+
+bool applyDelta(char* dst, size_t range, ImageRef delta) {
+  const unsigned char* d = (const unsigned char*)delta.data;
+  size_t pos = 0, p = 0;
+  while (p < delta.size) {
+    unsigned h = d[p++];
+    if (h < 0x80) {
+      size_t n = h + 1;
+      if (p + n > delta.size || pos + n > range)
+	return false;
+      for (size_t k = 0; k < n; ++k)
+	dst[pos + k] ^= d[p + k];
+      p += n;
+      pos += n;
+    } else {
+      size_t n = h - 0x80 + 3;
+      if (p >= delta.size || pos + n > range)
+	return false;
+      unsigned char x = d[p++];
+      if (x)
+	for (size_t k = 0; k < n; ++k)
+	  dst[pos + k] ^= x;
+      pos += n;
+    }
+  }
+  return pos == range;
+}
+
+void appendCheckpoint(string& out, int lsn, int prevLSN, int txID,
+		      const map<int, txTableEntry>& tx_table,
+		      const map<int, int>& dp_table) {
+  size_t start = startCheckpoint(out, lsn, prevLSN, txID);
+  for (map<int, txTableEntry>::const_iterator it = tx_table.begin(); it != tx_table.end(); ++it)
+    appendCheckpointTx(out, it->first, it->second);
+  size_t pages = startCheckpointPages(out);
+  for (map<int, int>::const_iterator it = dp_table.begin(); it != dp_table.end(); ++it)
+    appendCheckpointPage(out, it->first, it->second);
+  finishCheckpoint(out, start, pages);
+}
+
+size_t startCheckpoint(string& out, int lsn, int prevLSN, int txID) {
+  size_t start = startRecord(out, lsn, prevLSN, txID, END_CKPT);
+  putInt(out, 0); //tx count, see finishCheckpoint
+  return start;
+}
+
+void appendCheckpointTx(string& out, int txid, const txTableEntry& entry) {
+  putInt(out, txid);
+  putInt(out, entry.lastLSN);
+  putInt(out, entry.status);
+}
+
+size_t startCheckpointPages(string& out) {
+  size_t pages = out.size();
+  putInt(out, 0); //dirty page count
+  return pages;
+}
+
+void appendCheckpointPage(string& out, int page_id, int recLSN) {
+  putInt(out, page_id);
+  putInt(out, recLSN);
+}
+
+void finishCheckpoint(string& out, size_t start, size_t pages) {
+  size_t txs = start + sizeof(BinaryLogHeader);
+  int32_t tx_count = (pages - txs - 4) / 12;
+  int32_t page_count = (out.size() - pages - 4) / 8;
+  memcpy(&out[txs], &tx_count, sizeof(tx_count));
+  memcpy(&out[pages], &page_count, sizeof(page_count));
+  finishRecord(out, start);
+}
+
+void appendDeltaCheckpoint(string& out, int lsn, int prevLSN, int txID, int base,
+			   const map<int, txTableEntry>& tx_changed,
+			   const map<int, int>& pages_changed,
+			   const vector<int>& tx_gone, const vector<int>& pages_gone) {
+  size_t start = startCheckpoint(out, lsn, prevLSN, txID);
+  for (map<int, txTableEntry>::const_iterator it = tx_changed.begin(); it != tx_changed.end(); ++it)
+    appendCheckpointTx(out, it->first, it->second);
+  size_t pages = startCheckpointPages(out);
+  for (map<int, int>::const_iterator it = pages_changed.begin(); it != pages_changed.end(); ++it)
+    appendCheckpointPage(out, it->first, it->second);
+  finishCheckpoint(out, start, pages);
+  setDeltaFlag(out, start);
+  putInt(out, base);
+  putInt(out, tx_gone.size());
+  for (size_t i = 0; i < tx_gone.size(); ++i)
+    putInt(out, tx_gone[i]);
+  putInt(out, pages_gone.size());
+  for (size_t i = 0; i < pages_gone.size(); ++i)
+    putInt(out, pages_gone[i]);
+  finishRecord(out, start);
+}
+
+void setRecordLSN(char* rec, int lsn) {
+  int32_t v = lsn;
+  memcpy(rec + offsetof(BinaryLogHeader, lsn), &v, sizeof(v));
+}
+
+void setRecordPrevLSN(char* rec, int prevLSN) {
+  int32_t v = prevLSN;
+  memcpy(rec + offsetof(BinaryLogHeader, prevLSN), &v, sizeof(v));
+}
+
+void sealRecord(char* rec) {
+  LogRecordView view(rec);
+  uint32_t crc = recordCrc(rec, view.length());
+  memcpy(rec + offsetof(BinaryLogHeader, crc), &crc, sizeof(crc));
+}
+
+void encodeRecord(LogRecord* lr, string& out) {
+  size_t start = out.size();
+  switch (lr->getType()) {
+  case UPDATE: {
+    UpdateLogRecord* ulr = static_cast<UpdateLogRecord*>(lr);
+    appendUpdate(out, lr->getLSN(), lr->getprevLSN(), lr->getTxID(),
+		 ulr->getPageID(), ulr->getOffset(),
+		 imageOf(ulr->getBeforeImage()), imageOf(ulr->getAfterImage()));
+    break;
+  }
+  case CLR: {
+    CompensationLogRecord* clr = static_cast<CompensationLogRecord*>(lr);
+    appendCLR(out, lr->getLSN(), lr->getprevLSN(), lr->getTxID(),
+	      clr->getPageID(), clr->getOffset(),
+	      imageOf(clr->getAfterImage()), clr->getUndoNextLSN());
+    break;
+  }
+  case END_CKPT: {
+    ChkptLogRecord* chk = static_cast<ChkptLogRecord*>(lr);
+    appendCheckpoint(out, lr->getLSN(), lr->getprevLSN(), lr->getTxID(),
+		     chk->getTxTable(), chk->getDirtyPageTable());
+    break;
+  }
+  default:
+    appendRecord(out, lr->getLSN(), lr->getprevLSN(), lr->getTxID(), lr->getType());
+    break;
+  }
+  sealRecord(&out[start]);
+}
+
+static uint32_t frameCrc(LogFrameHeader h, const char* packed) {
+  h.crc = 0;
+  return crc32(packed, h.packed_length, crc32(&h, sizeof(h)));
+}
+
+void appendFrame(string& out, const char* recs, size_t len) {
+  size_t start = out.size();
+  LogFrameHeader h;
+  h.raw_length = len;
+  h.first_lsn = len ? LogRecordView(recs).getLSN() : -1;
+  out.append(sizeof(h), '\0');
+  lzCompress(recs, len, out);
+  if (out.size() - start - sizeof(h) >= len) {
+    out.resize(start + sizeof(h));
+    out.append(recs, len);
+  }
+  h.packed_length = out.size() - start - sizeof(h);
+  h.crc = frameCrc(h, &out[start] + sizeof(h));
+  memcpy(&out[start], &h, sizeof(h));
+}
+
+bool parseFrame(const char* buf, size_t avail, LogFrameHeader& h) {
+  if (avail < sizeof(h))
+    return false;
+  memcpy(&h, buf, sizeof(h));
+  return h.packed_length <= h.raw_length && h.packed_length <= avail - sizeof(h)
+    && h.crc == frameCrc(h, buf + sizeof(h));
+}
+
+bool unpackFrame(const char* buf, const LogFrameHeader& h, string& out) {
+  const char* packed = buf + sizeof(h);
+  if (h.packed_length == h.raw_length) {
+    out.append(packed, h.raw_length);
+    return true;
+  }
+  size_t start = out.size();
+  out.resize(start + h.raw_length);
+  if (lzDecompress(packed, h.packed_length, &out[start], h.raw_length))
+    return true;
+  out.resize(start);
+  return false;
+}
+
+string unframeLog(const string& log) {
+  if (!isFramedLog(log.data(), log.size()))
+    return log;
+  string out = binaryLogFileHeader();
+  size_t pos = LOG_FILE_HEADER_SIZE;
+  LogFrameHeader h;
+  while (parseFrame(log.data() + pos, log.size() - pos, h) && unpackFrame(log.data() + pos, h, out))
+    pos += sizeof(h) + h.packed_length;
+  return out;
+}
+
+LogRecord* decodeRecord(const LogRecordView& v) {
+  if (v.isDelta())
+    throw runtime_error("decodeRecord: delta record");
+  switch (v.getType()) {
+  case UPDATE:
+    return new UpdateLogRecord(v.getLSN(), v.getprevLSN(), v.getTxID(),
+			       v.getPageID(), v.getOffset(),
+			       v.getBeforeImage().str(), v.getAfterImage().str());
+  case CLR:
+    return new CompensationLogRecord(v.getLSN(), v.getprevLSN(), v.getTxID(),
+				     v.getPageID(), v.getOffset(),
+				     v.getAfterImage().str(), v.getUndoNextLSN());
+  case END_CKPT: {
+    map<int, txTableEntry> tx_table;
+    map<int, int> dp_table;
+    for (int i = 0; i < v.txCount(); ++i) {
+      int txid, lastLSN;
+      TxStatus status;
+      v.txEntry(i, txid, lastLSN, status);
+      tx_table[txid] = txTableEntry(lastLSN, status);
+    }
+    for (int i = 0; i < v.dirtyPageCount(); ++i) {
+      int page_id, recLSN;
+      v.dirtyPageEntry(i, page_id, recLSN);
+      dp_table[page_id] = recLSN;
+    }
+    return new ChkptLogRecord(v.getLSN(), v.getprevLSN(), v.getTxID(), tx_table, dp_table);
+  }
+  default:
+    return new LogRecord(v.getLSN(), v.getprevLSN(), v.getTxID(), v.getType());
+  }
+}
+
+static void putText(string& out, int v) {
+  char buf[16];
+  int n = snprintf(buf, sizeof(buf), "%d", v);
+  out.append(buf, n);
+}
+
+void formatText(const LogRecordView& v, string& out) {
+  static const char* names[] = {"update", "commit", "abort", "end", "CLR",
+				"begin_checkpoint", "end_checkpoint"};
+  putText(out, v.getLSN());
+  out += '\t';
+  putText(out, v.getprevLSN());
+  out += '\t';
+  putText(out, v.getTxID());
+  out += '\t';
+  out.append(names[v.getType()]);
+
+  switch (v.getType()) {
+  case UPDATE: {
+    ImageRef before = v.getBeforeImage();
+    ImageRef after = v.getAfterImage();
+    out += '\t';
+    putText(out, v.getPageID());
+    out += '\t';
+    putText(out, v.getOffset());
+    out += '\t';
+    out.append(before.data, before.size);
+    out += '\t';
+    out.append(after.data, after.size);
+    break;
+  }
+  case CLR: {
+    ImageRef after = v.getAfterImage();
+    out += '\t';
+    putText(out, v.getPageID());
+    out += '\t';
+    putText(out, v.getOffset());
+    out += '\t';
+    out.append(after.data, after.size);
+    out += '\t';
+    putText(out, v.getUndoNextLSN());
+    break;
+  }
+  case END_CKPT: {
+    out.append("\t{");
+    for (int i = 0; i < v.txCount(); ++i) {
+      int txid, lastLSN;
+      TxStatus status;
+      v.txEntry(i, txid, lastLSN, status);
+      out.append(" [ ");
+      putText(out, txid);
+      out += ' ';
+      putText(out, lastLSN);
+      out.append(status == U ? " U ]" : " C ]");
+    }
+    out.append("}\t{");
+    for (int i = 0; i < v.dirtyPageCount(); ++i) {
+      int page_id, recLSN;
+      v.dirtyPageEntry(i, page_id, recLSN);
+      out.append(" [ ");
+      putText(out, page_id);
+      out += ' ';
+      putText(out, recLSN);
+      out.append(" ]");
+    }
+    out += '}';
+    break;
+  }
+  default:
+    break;
+  }
+  out += '\n';
+}
@@ -0,0 +1,292 @@
+#ifndef LOGCODEC_H_
+#define LOGCODEC_H_
+
+#include "LogRecord.h"
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*
+ * Binary log format.
+ *
+ * A binary log file starts with LOG_FILE_MAGIC and a uint32 version,
+ * followed by records laid out back to back:
+ *
+ *   BinaryLogHeader   length, type, LSN, prevLSN, txID, crc
+ *   payload           depends on the type:
+ *     UPDATE    page_id, offset, before_len, before bytes, after_len, after bytes
+ *     CLR       page_id, offset, undoNextLSN, after_len, after bytes
+ *     END_CKPT  tx_count, (txid, lastLSN, status) * tx_count,
+ *               dp_count, (page_id, recLSN) * dp_count
+ *     others    nothing
+ *
+ * An UPDATE or CLR with RECORD_DELTA set in its type carries a delta
+ * instead of images:
+ *     UPDATE    page_id, offset, range, delta_len, delta bytes
+ *     CLR       page_id, offset, undoNextLSN, range, delta_len, delta bytes
+ * The delta is the before image XORed with the after image over range
+ * bytes at offset, run-length coded (see appendDelta). XOR is its own
+ * inverse, so the same delta redoes the update, undoes it, and redoes
+ * the CLR that undid it.
+ *
+ * An END_CKPT with RECORD_DELTA set holds only what changed since the
+ * checkpoint before it, which began at base:
+ *     END_CKPT  the tx and dirty page entries added or changed, as above,
+ *               then base, gone_tx_count, txid * gone_tx_count,
+ *               gone_dp_count, page_id * gone_dp_count
+ * The tables it stands for are those of the checkpoint at base with
+ * the entries replaced and the gone ones removed; a chain of them
+ * always leads back to a full END_CKPT.
+ *
+ * A compressed log has version LOG_FORMAT_FRAMED and holds frames
+ * instead of bare records, one per flush:
+ *
+ *   LogFrameHeader    raw_length, packed_length, first_lsn, crc
+ *   packed bytes      the records, LZ compressed (see Compress.h), or
+ *                     stored as they are if packed_length == raw_length
+ *
+ * first_lsn is the LSN of the first record in the frame, so the frame
+ * that holds an LSN is found from the frame headers alone. The crc
+ * covers the frame header with the crc field set to 0 and the packed
+ * bytes.
+ *
+ * All fields are 32-bit integers in host byte order. length covers the
+ * header and the payload; crc is the crc32 of the record with the crc
+ * field set to 0.
+ */
+
+const char LOG_FILE_MAGIC[8] = {'A', 'R', 'I', 'E', 'S', 'L', 'G', '\n'};
+const uint32_t LOG_FORMAT_VERSION = 1;
+const uint32_t LOG_FORMAT_FRAMED = 2;
+const size_t LOG_FILE_HEADER_SIZE = sizeof(LOG_FILE_MAGIC) + sizeof(uint32_t);
+const uint32_t RECORD_DELTA = 0x100; //flag in BinaryLogHeader::type
+
+struct BinaryLogHeader {
+  uint32_t length;
+  uint32_t type;
+  int32_t lsn;
+  int32_t prevLSN;
+  int32_t txID;
+  uint32_t crc;
+};
+
+struct LogFrameHeader {
+  uint32_t raw_length;
+  uint32_t packed_length;
+  int32_t first_lsn;
+  uint32_t crc;
+};
+
+/*
+ * A byte range inside a buffer; what std::string_view would be.
+ */
+struct ImageRef {
+  const char* data;
+  size_t size;
+
+  std::string str() const {return std::string(data, size);}
+};
+
+inline ImageRef imageOf(const std::string& s) {
+  ImageRef img = {s.data(), s.size()};
+  return img;
+}
+
+/*
+ * Returns true if buf starts with the binary log file header.
+ */
+bool isBinaryLog(const char* buf, size_t len);
+
+/*
+ * Returns true if buf starts with the file header of a compressed log.
+ */
+bool isFramedLog(const char* buf, size_t len);
+
+/*
+ * The file header every binary log starts with.
+ */
+std::string binaryLogFileHeader(bool framed = false);
+
+///////////////////  LogRecordView  ///////////////////
+
+/*
+ * Reads one binary record in place. Nothing is copied or allocated;
+ * the view is only valid while the buffer it points into is.
+ */
+class LogRecordView {
+ public:
+  LogRecordView() : rec(NULL), len(0) {}
+
+  /*
+   * Views a record this process encoded itself; nothing is checked.
+   */
+  explicit LogRecordView(const char* buf);
+
+  /*
+   * Checks the record at buf (at most avail bytes) and points the
+   * view at it. Returns false if the record is cut off or corrupt.
+   */
+  bool parse(const char* buf, size_t avail);
+
+  bool valid() const {return rec != NULL;}
+  const char* data() const {return rec;}
+  size_t length() const {return len;}
+  TxType getType() const {return (TxType)(field(4) & 0xff);}
+  bool isDelta() const {return field(4) & RECORD_DELTA;}
+  int getLSN() const {return field(8);}
+  int getprevLSN() const {return field(12);}
+  int getTxID() const {return field(16);}
+
+  //UPDATE and CLR
+  int getPageID() const {return field(sizeof(BinaryLogHeader));}
+  int getOffset() const {return field(sizeof(BinaryLogHeader) + 4);}
+  //UPDATE
+  ImageRef getBeforeImage() const;
+  //UPDATE and CLR
+  ImageRef getAfterImage() const;
+  //CLR
+  int getUndoNextLSN() const {return field(sizeof(BinaryLogHeader) + 8);}
+  //UPDATE and CLR with isDelta()
+  size_t getDeltaRange() const {return (uint32_t)field(deltaAt());}
+  ImageRef getDelta() const;
+
+  //END_CKPT
+  int txCount() const {return field(sizeof(BinaryLogHeader));}
+  void txEntry(int i, int& txid, int& lastLSN, TxStatus& status) const;
+  int dirtyPageCount() const;
+  void dirtyPageEntry(int i, int& page_id, int& recLSN) const;
+  //END_CKPT with isDelta()
+  int getCheckpointBase() const {return field(goneAt());}
+  int goneTxCount() const {return field(goneAt() + 4);}
+  int goneTx(int i) const {return field(goneAt() + 8 + i * 4);}
+  int gonePageCount() const {return field(goneAt() + 8 + goneTxCount() * 4);}
+  int gonePage(int i) const {return field(goneAt() + 12 + goneTxCount() * 4 + i * 4);}
+
+ private:
+  const char* rec;
+  size_t len;
+
+  int32_t field(size_t at) const;
+  size_t payloadEnd() const;
+  size_t deltaAt() const {return sizeof(BinaryLogHeader) + (getType() == CLR ? 12 : 8);}
+  size_t goneAt() const {return sizeof(BinaryLogHeader) + 8 + txCount() * 12 + dirtyPageCount() * 8;}
+};
+
+/////////////////// End LogRecordView  ///////////////////
+
+/*
+ * Append one record to out, built straight from its fields. The crc is
+ * left at 0: records kept in memory are never checked, and sealRecord
+ * fills it in before a record is written to a binary log.
+ */
+void appendRecord(std::string& out, int lsn, int prevLSN, int txID, TxType type);
+void appendUpdate(std::string& out, int lsn, int prevLSN, int txID,
+		  int page_id, int offset, ImageRef before, ImageRef after);
+void appendCLR(std::string& out, int lsn, int prevLSN, int txID,
+	       int page_id, int offset, ImageRef after, int undoNextLSN);
+/*
+ * Delta forms of appendUpdate and appendCLR. appendDeltaUpdate codes
+ * before and after (same size) itself; a CLR repeats its update's delta.
+ */
+void appendDeltaUpdate(std::string& out, int lsn, int prevLSN, int txID,
+		       int page_id, int offset, ImageRef before, ImageRef after);
+void appendDeltaCLR(std::string& out, int lsn, int prevLSN, int txID,
+		    int page_id, int offset, size_t range, ImageRef delta, int undoNextLSN);
+void appendCheckpoint(std::string& out, int lsn, int prevLSN, int txID,
+		      const std::map<int, txTableEntry>& tx_table,
+		      const std::map<int, int>& dirty_page_table);
+
+/*
+ * Builds an END_CKPT record a few entries at a time, so the tables can
+ * be copied in pieces: startCheckpoint, the tx entries,
+ * startCheckpointPages, the dirty pages, then finishCheckpoint with
+ * the two positions returned, which fills in the counts and length.
+ */
+size_t startCheckpoint(std::string& out, int lsn, int prevLSN, int txID);
+void appendCheckpointTx(std::string& out, int txid, const txTableEntry& entry);
+size_t startCheckpointPages(std::string& out);
+void appendCheckpointPage(std::string& out, int page_id, int recLSN);
+void finishCheckpoint(std::string& out, size_t start, size_t pages);
+
+/*
+ * The delta form of appendCheckpoint: the entries that were added or
+ * changed since the checkpoint that began at base, and the txids and
+ * page ids that are no longer in the tables.
+ */
+void appendDeltaCheckpoint(std::string& out, int lsn, int prevLSN, int txID, int base,
+			   const std::map<int, txTableEntry>& tx_changed,
+			   const std::map<int, int>& pages_changed,
+			   const std::vector<int>& tx_gone, const std::vector<int>& pages_gone);
+
+/*
+ * Appends before XOR after, run-length coded: a byte h < 0x80 is
+ * followed by h + 1 literal bytes, a byte h >= 0x80 by one byte that
+ * repeats h - 0x80 + 3 times. Unchanged bytes XOR to 0, so a sparse
+ * overwrite is mostly short runs of zeros.
+ */
+void appendDelta(std::string& out, ImageRef before, ImageRef after);
+
+/*
+ * XORs a delta into the range bytes at dst. Runs of zeros are skipped
+ * without touching dst. Returns false if the delta does not cover
+ * exactly range bytes.
+ */
+bool applyDelta(char* dst, size_t range, ImageRef delta);
+
+/*
+ * Overwrite the LSN or prevLSN of an encoded record, for records built
+ * before their LSN is handed out.
+ */
+void setRecordLSN(char* rec, int lsn);
+void setRecordPrevLSN(char* rec, int prevLSN);
+
+/*
+ * Stores the crc of the record at rec in its header.
+ */
+void sealRecord(char* rec);
+
+/*
+ * Appends the binary form of lr to out, sealed.
+ */
+void encodeRecord(LogRecord* lr, std::string& out);
+
+/*
+ * Appends len bytes of sealed records at recs to out as one frame,
+ * compressed unless that makes it bigger.
+ */
+void appendFrame(std::string& out, const char* recs, size_t len);
+
+/*
+ * Checks the frame at buf (at most avail bytes) and reads its header.
+ * Returns false if the frame is cut off or corrupt.
+ */
+bool parseFrame(const char* buf, size_t avail, LogFrameHeader& h);
+
+/*
+ * Appends the records of a frame that parseFrame accepted to out.
+ * Returns false if they do not unpack to raw_length bytes.
+ */
+bool unpackFrame(const char* buf, const LogFrameHeader& h, std::string& out);
+
+/*
+ * A compressed log with its frames unpacked: the plain binary file
+ * header, then the records of every frame up to the first one that
+ * is cut off or corrupt. Any other log comes back as it is.
+ */
+std::string unframeLog(const std::string& log);
+
+/*
+ * Builds a heap LogRecord from a binary record, for code that still
+ * works on the class hierarchy. Delta records have no LogRecord form;
+ * they throw runtime_error.
+ */
+LogRecord* decodeRecord(const LogRecordView& view);
+
+/*
+ * Appends the text form of a binary record to out, exactly as
+ * LogRecord::toString would print it. Not for delta records.
+ */
+void formatText(const LogRecordView& view, std::string& out);
+
+#endif
@@ -1,8 +1,12 @@
 #include "LogMgr.h"
+#include "LogCodec.h"
 #include <sstream>
 #include <string>
 #include <algorithm>
 #include <queue>
+#include <unordered_map>
+#include <exception>
+#include <stdexcept>
 
 using namespace std;
 
@@ -17,20 +21,19 @@ struct CompareSecond
 
 struct ToUndoComp
 {
-    bool operator()(LogRecord * left, LogRecord * right) 
+    bool operator()(const LogRecordView& left, const LogRecordView& right) 
     {
-        return left->getLSN() > right->getLSN();
+        return left.getLSN() > right.getLSN();
     }
 };
 
-int findLSN(vector <LogRecord*> log, int LSN);
-
 /*
  * Find the LSN of the most recent log record for this TX.
  * If there is no previous log record for this TX, return 
  * the null LSN.
  */
 int LogMgr::getLastLSN(int txnum){
+    lock_guard<recursive_mutex> tables(table_mutex);
     return tx_table[txnum].lastLSN;
 }
 
@@ -39,6 +42,7 @@ int LogMgr::getLastLSN(int txnum){
  * log entry for this transaction.
  */
 void LogMgr::setLastLSN(int txnum, int lsn){
+    lock_guard<recursive_mutex> tables(table_mutex);
     tx_table[txnum].lastLSN = lsn;
 }
 
@@ -48,53 +52,188 @@ void LogMgr::setLastLSN(int txnum, int lsn){
  * logtail once they're written!
  */
 void LogMgr::flushLogTail(int maxLSN){
-    while(!logtail.empty() && logtail.front()->getLSN() <= maxLSN){
-        se->updateLog(logtail.front()->toString());
-        delete logtail.front();
-        *(logtail.begin()) = nullptr;
-        logtail.erase(logtail.begin());
+    lock_guard<mutex> flushing(flush_mutex);
+    uint64_t start = logtail.head();
+    uint64_t end = logtail.committed();
+    uint64_t pos = start;
+    //records are contiguous until the ring wraps, hand them over in runs
+    char* run = NULL;
+    size_t run_len = 0;
+    while(pos < end){
+        char* rec = logtail.at(pos);
+        LogRecordView view(rec);
+        if(view.getLSN() > maxLSN) break;
+        if(run && run + run_len != rec){
+            appendRecords(run, run_len);
+            run = NULL;
+        }
+        if(!run){
+            run = rec;
+            run_len = 0;
+        }
+        run_len += view.length();
+        pos += view.length();
+    }
+    if(pos == start) return;
+    appendRecords(run, run_len);
+    //one write for the whole batch
+    se->forceLog();
+    logtail.release(pos);
+}
+
+void LogMgr::appendRecords(char* recs, size_t len){
+    if(se->getLogFormat() == BINARY_LOG){
+        for(size_t at = 0; at < len; at += LogRecordView(recs + at).length()){
+            sealRecord(recs + at);
+            if(LogRecordView(recs + at).getType() == BEGIN_CKPT) noteCheckpoint(LogRecordView(recs + at), at);
+        }
+        se->appendLog(recs, len);
+        return;
+    }
+    flush_text.clear();
+    for(size_t at = 0; at < len; at += LogRecordView(recs + at).length()){
+        if(LogRecordView(recs + at).getType() == BEGIN_CKPT) noteCheckpoint(LogRecordView(recs + at), flush_text.size());
+        formatText(LogRecordView(recs + at), flush_text);
+    }
+    se->appendLog(flush_text);
+}
+
+void LogMgr::noteCheckpoint(const LogRecordView& rec, size_t offset){
+    ckpt_position = se->logPosition(offset);
+    ckpt_position_lsn = rec.getLSN();
+}
+
+int LogMgr::logRecord(string& rec){
+    if(auto_checkpoint){
+        size_t trigger = checkpoint_bytes;
+        size_t before = bytes_since_checkpoint.fetch_add(rec.size());
+        if(trigger && before < trigger && before + rec.size() >= trigger){
+            lock_guard<mutex> waking(checkpoint_mutex);
+            checkpoint_cv.notify_one();
+        }
+    }
+    int lsn;
+    //the flusher finds a record by its own position in the ring, so
+    //each record of a batch gets a reservation of its own
+    static thread_local vector<uint64_t> starts;
+    starts.clear();
+    {
+        lock_guard<mutex> appending(append_mutex);
+        lsn = se->nextLSN();
+        setRecordLSN(&rec[0], lsn);
+        int prev = lsn;
+        for(size_t at = LogRecordView(rec.data()).length(); at < rec.size(); at += LogRecordView(&rec[at]).length()){
+            int next = se->nextLSN();
+            setRecordLSN(&rec[at], next);
+            setRecordPrevLSN(&rec[at], prev);
+            prev = next;
+        }
+        if(rec.size() > logtail.capacity()){
+            //no new reservations while append_mutex is held; let the
+            //ones in flight land so the log stays in LSN order
+            while(logtail.committed() != logtail.reserved()) this_thread::yield();
+            flushLogTail(numeric_limits<int>::max());
+            lock_guard<mutex> flushing(flush_mutex);
+            appendRecords(&rec[0], rec.size());
+            se->forceLog();
+            return lsn;
+        }
+        for(size_t at = 0; at < rec.size(); at += LogRecordView(&rec[at]).length()){
+            starts.push_back(logtail.reserve(LogRecordView(&rec[at]).length()));
+        }
+    }
+    for(size_t k = 0, at = 0; k < starts.size(); ++k){
+        size_t len = LogRecordView(&rec[at]).length();
+        logtail.publish(starts[k], &rec[at], len);
+        at += len;
     }
+    return lsn;
 }
 
 /* 
  * Run the analysis phase of ARIES.
  */
-void LogMgr::analyze(vector <LogRecord*> log){
+void LogMgr::analyze(const LogView& log){
     //int a;
     //cin >> a;
-    LogRecord * newRecord;
-    int checkNum = findLSN(log, se->get_master());
-    if(checkNum == NULL_LSN){
+    int checkNum = log.position(se->get_master());
+    int endNum = checkNum == NULL_LSN ? log.size() : checkpointEnd(log, se->get_master());
+    if(endNum == (int)log.size() || !loadCheckpoint(log, endNum)){
         checkNum = 0;
     }
     else{
-        tx_table = dynamic_cast<ChkptLogRecord *>(log[checkNum + 1])->getTxTable();
-        dirty_page_table = dynamic_cast<ChkptLogRecord *>(log[checkNum + 1])->getDirtyPageTable();
-        checkNum += 2;
+        //replay what happened since begin_checkpoint on top of the tables
+        checkNum += 1;
     }
     
-    for(int i = checkNum; i < log.size(); ++i){
-        newRecord = log[i];
-        int txID = newRecord->getTxID();
-        if (newRecord->getType() == END){
+    for(int i = checkNum; i < (int)log.size(); ++i){
+        LogRecordView newRecord = log[i];
+        if(newRecord.getType() == BEGIN_CKPT || newRecord.getType() == END_CKPT) continue;
+        int txID = newRecord.getTxID();
+        if (newRecord.getType() == END){
             tx_table.erase(txID); 
+            tx_first_lsn.erase(txID);
         }
         else{
-            tx_table[txID].lastLSN = newRecord->getLSN();
-            if(newRecord->getType() == COMMIT){
+            if(newRecord.getprevLSN() == NULL_LSN) tx_first_lsn[txID] = newRecord.getLSN();
+            tx_table[txID].lastLSN = newRecord.getLSN();
+            if(newRecord.getType() == COMMIT){
                 tx_table[txID].status = C;
             }
             else{
                 tx_table[txID].status = U;
             }
         }
-        if(newRecord->getType() == CLR){
-            dirty_page_table[dynamic_cast<CompensationLogRecord *>(newRecord)->getPageID()] = newRecord->getLSN();
+        switch(newRecord.getType()){
+        case UPDATE:
+        case CLR:
+            dirty_page_table[newRecord.getPageID()] = newRecord.getLSN();
+            break;
+        default:
+            break;
         }
-        else if(newRecord->getType() == UPDATE){
-            dirty_page_table[dynamic_cast<UpdateLogRecord *>(newRecord)->getPageID()] = newRecord->getLSN();
+    }
+}
+
+int LogMgr::checkpointEnd(const LogView& log, int begin_lsn){
+    int pos = log.position(begin_lsn);
+    if(pos == NULL_LSN) return log.size();
+    //a fuzzy checkpoint can have other records between its begin and end
+    for(++pos; pos < (int)log.size(); ++pos){
+        if(log[pos].getType() == END_CKPT && log[pos].getprevLSN() == begin_lsn) break;
+    }
+    return pos;
+}
+
+bool LogMgr::loadCheckpoint(const LogView& log, int endNum){
+    //back to the full checkpoint, newest first
+    vector<int> chain(1, endNum);
+    while(log[chain.back()].isDelta()){
+        int base = checkpointEnd(log, log[chain.back()].getCheckpointBase());
+        if(base >= chain.back()) return false;
+        chain.push_back(base);
+    }
+    tx_table.clear();
+    tx_first_lsn.clear();
+    dirty_page_table.clear();
+    for(vector<int>::reverse_iterator it = chain.rbegin(); it != chain.rend(); ++it){
+        LogRecordView chk = log[*it];
+        for(int i = 0; i < chk.txCount(); ++i){
+            int txid, lastLSN;
+            TxStatus status;
+            chk.txEntry(i, txid, lastLSN, status);
+            tx_table[txid] = txTableEntry(lastLSN, status);
+        }
+        for(int i = 0; i < chk.dirtyPageCount(); ++i){
+            int page_id, recLSN;
+            chk.dirtyPageEntry(i, page_id, recLSN);
+            dirty_page_table[page_id] = recLSN;
         }
+        if(!chk.isDelta()) continue;
+        for(int i = 0; i < chk.goneTxCount(); ++i) tx_table.erase(chk.goneTx(i));
+        for(int i = 0; i < chk.gonePageCount(); ++i) dirty_page_table.erase(chk.gonePage(i));
     }
+    return true;
 }
 
 /*
@@ -102,40 +241,133 @@ void LogMgr::analyze(vector <LogRecord*> log){
  * If the StorageEngine stops responding, return false.
  * Else when redo phase is complete, return true. 
  */
-bool LogMgr::redo(vector <LogRecord*> log){
-    LogRecord * newRecord;
-    int firstDirty = min_element(dirty_page_table.begin(), dirty_page_table.end(), CompareSecond())->second;
-    firstDirty = findLSN(log, firstDirty);
-    for(int i = firstDirty; i < log.size(); ++i){
-        newRecord = log[i];
-        if(newRecord->getType() == CLR){
-            CompensationLogRecord * cRecord = dynamic_cast<CompensationLogRecord *>(newRecord);
-            if(dirty_page_table.count(cRecord->getPageID()) && dirty_page_table[cRecord->getPageID()] <= cRecord->getLSN()){
-                if(se->getLSN(cRecord->getPageID()) < cRecord->getLSN()){
-                    if(!se->pageWrite(cRecord->getPageID(), cRecord->getOffset(), cRecord->getAfterImage(), cRecord->getLSN())) return false;
-                }
+bool LogMgr::redo(const LogView& log){
+    int firstDirty = firstDirtyPosition(log);
+    PageGuard page;
+    int ahead = firstDirty + 1; //first record whose page is not asked for yet
+    int last_prefetched = -1;
+    if(redo_threads > 1){
+        if(!parallelRedo(log, firstDirty)) return false;
+    }
+    else for(int i = firstDirty; i < (int)log.size(); ++i){
+        for(; redo_read_ahead && ahead < (int)log.size() && ahead <= i + (int)redo_read_ahead; ++ahead){
+            LogRecordView next = log[ahead];
+            if(redoCandidate(next) && next.getPageID() != last_prefetched){
+                last_prefetched = next.getPageID();
+                se->prefetchPage(last_prefetched);
             }
         }
-        else if(newRecord->getType() == UPDATE){
-            UpdateLogRecord * uRecord = dynamic_cast<UpdateLogRecord *>(newRecord);
-            if(dirty_page_table.count(uRecord->getPageID()) && dirty_page_table[uRecord->getPageID()] <= uRecord->getLSN()){
-                if(se->getLSN(uRecord->getPageID()) < uRecord->getLSN()){
-                    if(!se->pageWrite(uRecord->getPageID(), uRecord->getOffset(), uRecord->getAfterImage(), uRecord->getLSN())) return false;
-                }
-            }
+        LogRecordView rec = log[i];
+        if(!redoCandidate(rec)) continue;
+        //a run of records on one page keeps it pinned
+        if(!page.valid() || page.pageID() != rec.getPageID()){
+            page.release();
+            page = se->pinPage(rec.getPageID());
+            if(!page.valid()) throw out_of_range("LogMgr::redo");
+        }
+        if(page.pageLSN() < rec.getLSN()){
+            if(!se->pageRedo(page, rec)) return false;
         }
     }
+    page.release();
+    endCommitted();
+    return true;
+}
+
+/*
+ * An UPDATE or CLR redo has to compare with its page's pageLSN.
+ */
+bool LogMgr::redoCandidate(const LogRecordView& rec){
+    if(rec.getType() != UPDATE && rec.getType() != CLR) return false;
+    map<int, int>::iterator dp = dirty_page_table.find(rec.getPageID());
+    return dp != dirty_page_table.end() && dp->second <= rec.getLSN();
+}
+
+int LogMgr::firstDirtyPosition(const LogView& log){
+    if(dirty_page_table.empty()) return log.size();
+    int firstDirty = min_element(dirty_page_table.begin(), dirty_page_table.end(), CompareSecond())->second;
+    return max(0, log.position(firstDirty));
+}
+
+void LogMgr::endCommitted(){
     for(map<int, txTableEntry>::iterator it = tx_table.begin(); it != tx_table.end(); ){
         if(it->second.status == C){
-            logtail.push_back(new LogRecord(se->nextLSN(), it->second.lastLSN, it->first, END));
+            record.clear();
+            appendRecord(record, 0, it->second.lastLSN, it->first, END);
+            logRecord(record);
+            tx_first_lsn.erase(it->first);
             tx_table.erase(it++);
         }
         else{
             ++it;
         }
     }
-    
-    return true;
+}
+
+/*
+ * Redo with redo_threads workers. Records of one page always go to the
+ * same worker, which applies them in log order. Which records need
+ * redoing, and how many of them fit the StorageEngine's page write
+ * budget, is worked out here first, in log order, exactly as the
+ * sequential loop would decide it; the workers' pageWrite calls then
+ * never fail, whatever order the threads run in.
+ */
+bool LogMgr::parallelRedo(const LogView& log, int firstDirty){
+    int budget = se->getPageWritesPermitted();
+    bool complete = true;
+    unordered_map<int, int> pageLSN; //as redo has left each page so far
+    vector<vector<int> > queues(redo_threads);
+    for(int i = firstDirty; i < (int)log.size(); ++i){
+        LogRecordView rec = log[i];
+        if(rec.getType() != UPDATE && rec.getType() != CLR) continue;
+        int page_id = rec.getPageID();
+        map<int, int>::iterator dp = dirty_page_table.find(page_id);
+        if(dp == dirty_page_table.end() || dp->second > rec.getLSN()) continue;
+        unordered_map<int, int>::iterator pl = pageLSN.find(page_id);
+        if(pl == pageLSN.end()) pl = pageLSN.insert(make_pair(page_id, se->getLSN(page_id))).first;
+        if(pl->second >= rec.getLSN()) continue;
+        //the write the sequential loop would have failed on
+        if(budget <= 0){
+            complete = false;
+            break;
+        }
+        --budget;
+        pl->second = rec.getLSN();
+        queues[page_id % redo_threads].push_back(i);
+    }
+
+    vector<thread> workers;
+    vector<exception_ptr> errors(queues.size());
+    for(unsigned w = 0; w < redo_threads; ++w){
+        workers.push_back(thread([this, &log, &queues, &errors, w]{
+            try{
+                for(unsigned j = 0; j < queues[w].size(); ++j){
+                    LogRecordView rec = log[queues[w][j]];
+                    se->pageRedo(rec);
+                }
+            }
+            catch(...){
+                errors[w] = current_exception();
+            }
+        }));
+    }
+    for(unsigned w = 0; w < workers.size(); ++w){
+        workers[w].join();
+    }
+    for(unsigned w = 0; w < errors.size(); ++w){
+        if(errors[w]) rethrow_exception(errors[w]);
+    }
+    return complete;
+}
+
+void LogMgr::setRedoThreads(unsigned threads){
+    lock_guard<recursive_mutex> guard(log_mutex);
+    redo_threads = threads;
+}
+
+void LogMgr::setRedoReadAhead(unsigned records){
+    lock_guard<recursive_mutex> guard(log_mutex);
+    redo_read_ahead = records;
 }
 
 /*
@@ -143,59 +375,205 @@ bool LogMgr::redo(vector <LogRecord*> log){
  * If a txnum is provided, abort that transaction.
  * Hint: the logic is very similar for these two tasks!
  */
-void LogMgr::undo(vector <LogRecord*> log, int txnum){
-    priority_queue <LogRecord *, vector<LogRecord *>, ToUndoComp> ToUndo;
+void LogMgr::undo(const LogView& log, int txnum){
+    if(txnum == NULL_TX && undo_threads > 1){
+        parallelUndo(log);
+        return;
+    }
+    vector<LogRecordView> from;
     if(txnum == NULL_TX){
         for(map<int, txTableEntry>::iterator it = tx_table.begin(); it != tx_table.end(); it++){
-            ToUndo.push(log[findLSN(log,it->second.lastLSN)]);
+            from.push_back(log.find(it->second.lastLSN));
         }
     }
     else{
-        ToUndo.push(log[findLSN(log,tx_table[txnum].lastLSN)]);
+        from.push_back(log.find(getLastLSN(txnum)));
     }
-    while(!ToUndo.empty()){
-        LogRecord * newRecord = ToUndo.top();
+    rollBack(log, from, NULL_LSN);
+}
+
+bool LogMgr::rollBack(const LogView& log, const vector<LogRecordView>& from, int stopLSN,
+                      bool budgeted){
+    priority_queue <LogRecordView, vector<LogRecordView>, ToUndoComp> ToUndo(ToUndoComp(), from);
+    //undo workers run this side by side, each builds records in its own buffer
+    string rec;
+    while(!ToUndo.empty() && ToUndo.top().getLSN() > stopLSN){
+        LogRecordView newRecord = ToUndo.top();
         ToUndo.pop();
-        if(newRecord->getType() == CLR){
-            CompensationLogRecord * cRecord = dynamic_cast<CompensationLogRecord *>(newRecord);
-            if(cRecord->getUndoNextLSN() == NULL_LSN){
-                LogRecord e(se->nextLSN(), cRecord->getLSN(), cRecord->getTxID(), END);
-                logtail.push_back(new LogRecord (se->nextLSN(), cRecord->getLSN(), cRecord->getTxID(), END));
-                tx_table.erase(cRecord->getTxID());
+        int txID = newRecord.getTxID();
+        switch(newRecord.getType()){
+        case CLR:
+            if(newRecord.getUndoNextLSN() == NULL_LSN){
+                se->nextLSN(); //skips an LSN on purpose, as the reference logs do
+                rec.clear();
+                appendRecord(rec, 0, newRecord.getLSN(), txID, END);
+                unsigned slot = beginTableUpdate();
+                logRecord(rec);
+                endTx(txID);
+                endTableUpdate(slot);
             }
             else{
-                ToUndo.push(log[findLSN(log,cRecord->getUndoNextLSN())]);
+                ToUndo.push(log.find(newRecord.getUndoNextLSN()));
             }
-        }
-        else if(newRecord->getType() == UPDATE){
-            UpdateLogRecord * uRecord = dynamic_cast<UpdateLogRecord *>(newRecord);
-            if(!se->pageWrite(uRecord->getPageID(), uRecord->getOffset(), uRecord->getBeforeImage(), uRecord->getprevLSN())) return;
-            int cLSN = se->nextLSN();
-            logtail.push_back(new CompensationLogRecord (cLSN, getLastLSN(uRecord->getTxID()), uRecord->getTxID(), uRecord->getPageID(), uRecord->getOffset(), uRecord->getBeforeImage(), uRecord->getprevLSN()));
-            setLastLSN(uRecord->getTxID(), cLSN);
-            if(uRecord->getprevLSN() != NULL_LSN){
-                ToUndo.push(log[findLSN(log,uRecord->getprevLSN())]);
+            break;
+        case UPDATE: {
+            unsigned slot;
+            int cLSN;
+            rec.clear();
+            if(newRecord.isDelta()){
+                //a delta must not be redone twice, so the page takes the
+                //CLR's LSN and the CLR goes first; if the page write
+                //fails, redo applies the CLR after the crash
+                appendDeltaCLR(rec, 0, getLastLSN(txID), txID, newRecord.getPageID(), newRecord.getOffset(),
+                               newRecord.getDeltaRange(), newRecord.getDelta(), newRecord.getprevLSN());
+                slot = beginTableUpdate();
+                cLSN = logRecord(rec);
+                cacheUndo(txID, LogRecordView(rec.data()));
+                setLastLSN(txID, cLSN);
+                if(!se->pageUndo(newRecord, cLSN, budgeted)){
+                    endTableUpdate(slot);
+                    return false;
+                }
+            }
+            else{
+                if(!se->pageUndo(newRecord, newRecord.getprevLSN(), budgeted)) return false;
+                appendCLR(rec, 0, getLastLSN(txID), txID, newRecord.getPageID(), newRecord.getOffset(), newRecord.getBeforeImage(), newRecord.getprevLSN());
+                slot = beginTableUpdate();
+                cLSN = logRecord(rec);
+                cacheUndo(txID, LogRecordView(rec.data()));
+                setLastLSN(txID, cLSN);
+            }
+            if(newRecord.getprevLSN() != NULL_LSN){
+                ToUndo.push(log.find(newRecord.getprevLSN()));
             }
             else{
-                logtail.push_back(new LogRecord (se->nextLSN(), cLSN, uRecord->getTxID(), END));
-                tx_table.erase(uRecord->getTxID());
+                rec.clear();
+                appendRecord(rec, 0, cLSN, txID, END);
+                logRecord(rec);
+                endTx(txID);
             }
+            endTableUpdate(slot);
+            break;
         }
-        else{
-            ToUndo.push(log[findLSN(log,newRecord->getprevLSN())]);
+        default:
+            ToUndo.push(log.find(newRecord.getprevLSN()));
+            break;
+        }
+    }
+    return true;
+}
+
+/*
+ * Undo with undo_threads workers. A dry run of the sequential loop,
+ * without writing anything, finds the records it would visit, the
+ * update it would stop at once the page write budget is gone, and
+ * which losers share a page. Losers sharing a page (directly or
+ * through others) form one group; each group goes whole to a worker,
+ * which runs the ordinary undo loop over it up to the same stop point.
+ */
+void LogMgr::parallelUndo(const LogView& log){
+    vector<LogRecordView> losers;
+    priority_queue <LogRecordView, vector<LogRecordView>, ToUndoComp> ToUndo;
+    for(map<int, txTableEntry>::iterator it = tx_table.begin(); it != tx_table.end(); it++){
+        losers.push_back(log.find(it->second.lastLSN));
+        ToUndo.push(losers.back());
+    }
+    //union-find over transaction ids, joined through the pages they wrote
+    unordered_map<int, int> group;
+    unordered_map<int, int> pageOwner;
+    function<int(int)> root = [&](int tx){
+        unordered_map<int, int>::iterator g = group.find(tx);
+        if(g == group.end()) return group[tx] = tx;
+        if(g->second == tx) return tx;
+        return g->second = root(g->second);
+    };
+    int budget = se->getPageWritesPermitted();
+    int stopLSN = NULL_LSN;
+    while(!ToUndo.empty()){
+        LogRecordView rec = ToUndo.top();
+        ToUndo.pop();
+        int next = NULL_LSN;
+        switch(rec.getType()){
+        case CLR:
+            next = rec.getUndoNextLSN();
+            break;
+        case UPDATE: {
+            if(budget <= 0){
+                //the write the sequential loop would have failed on
+                stopLSN = rec.getLSN();
+                break;
+            }
+            --budget;
+            int tx = root(rec.getTxID());
+            unordered_map<int, int>::iterator owner = pageOwner.find(rec.getPageID());
+            if(owner == pageOwner.end()) pageOwner[rec.getPageID()] = tx;
+            else group[root(owner->second)] = tx;
+            next = rec.getprevLSN();
+            break;
         }
+        default:
+            next = rec.getprevLSN();
+            break;
+        }
+        if(stopLSN != NULL_LSN) break;
+        if(next != NULL_LSN) ToUndo.push(log.find(next));
+    }
+
+    //whole groups to workers, round robin
+    unordered_map<int, unsigned> worker_of;
+    vector<vector<LogRecordView> > queues(undo_threads);
+    for(unsigned i = 0; i < losers.size(); ++i){
+        int r = root(losers[i].getTxID());
+        unordered_map<int, unsigned>::iterator w = worker_of.find(r);
+        if(w == worker_of.end()) w = worker_of.insert(make_pair(r, worker_of.size() % undo_threads)).first;
+        queues[w->second].push_back(losers[i]);
+    }
+
+    vector<thread> workers;
+    vector<exception_ptr> errors(queues.size());
+    for(unsigned w = 0; w < undo_threads; ++w){
+        if(queues[w].empty()) continue;
+        workers.push_back(thread([this, &log, &queues, &errors, stopLSN, w]{
+            try{
+                rollBack(log, queues[w], stopLSN);
+            }
+            catch(...){
+                errors[w] = current_exception();
+            }
+        }));
+    }
+    for(unsigned w = 0; w < workers.size(); ++w){
+        workers[w].join();
+    }
+    for(unsigned w = 0; w < errors.size(); ++w){
+        if(errors[w]) rethrow_exception(errors[w]);
     }
 }
 
+void LogMgr::setUndoThreads(unsigned threads){
+    lock_guard<recursive_mutex> guard(log_mutex);
+    undo_threads = threads;
+}
+
 
-vector<LogRecord*> LogMgr::stringToLRVector(string logstring){
-    vector<LogRecord*> result;
+string LogMgr::stringToRecords(string logstring){
+    if(isBinaryLog(logstring.data(), logstring.size())){
+        size_t pos = LOG_FILE_HEADER_SIZE;
+        LogRecordView view;
+        while(view.parse(logstring.data() + pos, logstring.size() - pos)){
+            pos += view.length();
+        }
+        logstring.resize(pos);
+        logstring.erase(0, LOG_FILE_HEADER_SIZE);
+        return logstring;
+    }
+    string result;
     istringstream stream(logstring);
     string line;
     while (getline(stream, line)) {
-        LogRecord* lr;
-        lr = LogRecord::stringToRecordPtr(line);
-        result.push_back(lr);
+        LogRecord* lr = LogRecord::stringToRecordPtr(line);
+        encodeRecord(lr, result);
+        delete lr;
     }
     return result; 
 }
@@ -205,35 +583,461 @@ vector<LogRecord*> LogMgr::stringToLRVector(string logstring){
  * Hint: you can use your undo function
  */
 void LogMgr::abort(int txid){
-    int LSN = se->nextLSN();
-    logtail.push_back(new LogRecord(LSN, getLastLSN(txid), txid, ABORT));
+    txNeeded(txid);
+    lock_guard<recursive_mutex> guard(log_mutex);
+    record.clear();
+    appendRecord(record, 0, getLastLSN(txid), txid, ABORT);
+    int LSN = logRecord(record);
     setLastLSN(txid,LSN);
+    cacheUndo(txid, LogRecordView(record.data()));
     flushLogTail(LSN);
-    undo(stringToLRVector(se->getLog()),txid);
+    //only this transaction's records are needed to roll it back,
+    //straight from memory unless some of them were not cached
+    string chain;
+    if(!cachedTxChain(txid, chain)) chain = readTxChain(LSN);
+    undo(LogView(std::move(chain)),txid);
+    lock_guard<recursive_mutex> tables(table_mutex);
+    if(!tx_table.count(txid)) dropUndoChain(txid);
+}
+
+LogReader* LogMgr::readerFor(int lsn){
+    string file = se->getLogFileName(lsn);
+    map<string, LogReader*>::iterator it = readers.find(file);
+    if(it == readers.end()) it = readers.insert(make_pair(file, new LogReader(file))).first;
+    return it->second;
+}
+
+string LogMgr::readTxChain(int lastLSN){
+    string chain;
+    //a segmented log may hold the chain in several files
+    for(int lsn = lastLSN; lsn != NULL_LSN; ){
+        size_t at = chain.size();
+        if(!readerFor(lsn)->readEncoded(lsn, chain)) break;
+        lsn = LogRecordView(&chain[at]).getprevLSN();
+    }
+    return chain;
+}
+
+void LogMgr::cacheUndo(int txid, const LogRecordView& rec){
+    lock_guard<recursive_mutex> tables(table_mutex);
+    map<int, string>::iterator it = undo_chains.find(txid);
+    //a chain has to start at the transaction's first record
+    if(it == undo_chains.end()){
+        if(rec.getprevLSN() != NULL_LSN) return;
+        it = undo_chains.insert(make_pair(txid, string())).first;
+    }
+    if(undo_cache_bytes + rec.length() > undo_cache_limit){
+        dropUndoChain(txid);
+        return;
+    }
+    size_t before = it->second.size();
+    if(rec.getType() == UPDATE && !rec.isDelta()){
+        //undo never needs the after image
+        ImageRef none = {"", 0};
+        appendUpdate(it->second, rec.getLSN(), rec.getprevLSN(), txid,
+                     rec.getPageID(), rec.getOffset(), rec.getBeforeImage(), none);
+    }
+    else{
+        it->second.append(rec.data(), rec.length());
+    }
+    undo_cache_bytes += it->second.size() - before;
+}
+
+void LogMgr::dropUndoChain(int txid){
+    lock_guard<recursive_mutex> tables(table_mutex);
+    map<int, string>::iterator it = undo_chains.find(txid);
+    if(it == undo_chains.end()) return;
+    undo_cache_bytes -= it->second.size();
+    undo_chains.erase(it);
+}
+
+void LogMgr::endTx(int txid){
+    lock_guard<recursive_mutex> tables(table_mutex);
+    tx_table.erase(txid);
+    tx_first_lsn.erase(txid);
+    dropUndoChain(txid);
+}
+
+bool LogMgr::cachedTxChain(int txid, string& chain){
+    lock_guard<recursive_mutex> tables(table_mutex);
+    map<int, string>::iterator it = undo_chains.find(txid);
+    if(it == undo_chains.end() || it->second.empty()) return false;
+    int lastLSN = NULL_LSN;
+    for(size_t pos = 0; pos < it->second.size(); ){
+        LogRecordView rec(&it->second[pos]);
+        lastLSN = rec.getLSN();
+        pos += rec.length();
+    }
+    if(lastLSN != getLastLSN(txid)) return false;
+    chain = it->second;
+    return true;
+}
+
+void LogMgr::setUndoCacheLimit(size_t bytes){
+    lock_guard<recursive_mutex> guard(log_mutex);
+    undo_cache_limit = bytes;
+}
+
+void LogMgr::setDeltaLogging(bool on){
+    lock_guard<recursive_mutex> guard(log_mutex);
+    delta_logging = on;
+}
+
+void LogMgr::setDeltaCheckpoints(unsigned full_every){
+    lock_guard<mutex> one(checkpointing);
+    full_checkpoint_every = full_every;
+}
+
+void LogMgr::setLogTailCapacity(size_t bytes){
+    lock_guard<recursive_mutex> guard(log_mutex);
+    flushLogTail(numeric_limits<int>::max());
+    logtail = LogTail(bytes);
+}
+
+/*
+ * The entries of now that are not the same in before, and the keys
+ * of before that are not in now.
+ */
+template <class T, class Same>
+static void diffTable(const map<int, T>& before, const map<int, T>& now,
+                      map<int, T>& changed, vector<int>& gone, Same same){
+    typename map<int, T>::const_iterator b = before.begin();
+    for(typename map<int, T>::const_iterator n = now.begin(); n != now.end(); ++n){
+        for(; b != before.end() && b->first < n->first; ++b) gone.push_back(b->first);
+        if(b != before.end() && b->first == n->first){
+            if(!same(b->second, n->second)) changed.insert(changed.end(), *n);
+            ++b;
+        }
+        else changed.insert(changed.end(), *n);
+    }
+    for(; b != before.end(); ++b) gone.push_back(b->first);
 }
 
 /*
  * Write the begin checkpoint and end checkpoint
  */
 void LogMgr::checkpoint(){
-    int LSN = se->nextLSN();
-    logtail.push_back(new LogRecord(LSN, NULL_LSN, NULL_TX, BEGIN_CKPT));
-    int LSN2 = se->nextLSN();
-    logtail.push_back(new ChkptLogRecord(LSN2, LSN, NULL_TX, tx_table, dirty_page_table));
+    fuzzyCheckpoint();
+}
+
+void LogMgr::fuzzyCheckpoint(){
+    lock_guard<mutex> one(checkpointing);
+    int LSN;
+    {
+        //commit, abort and recovery update the tables under log_mutex
+        lock_guard<recursive_mutex> guard(log_mutex);
+        ckpt_record.clear();
+        appendRecord(ckpt_record, 0, NULL_LSN, NULL_TX, BEGIN_CKPT);
+        LSN = logRecord(ckpt_record);
+        bytes_since_checkpoint = 0;
+        unsigned old = table_epoch++;
+        while(tables_in_flight[old & 1] != 0) this_thread::yield();
+    }
+    ckpt_record.clear();
+    bool keep_tables = full_checkpoint_every > 1 && se->getLogFormat() == BINARY_LOG;
+    bool delta = keep_tables && last_ckpt_lsn != NULL_LSN && deltas_since_full + 1 < full_checkpoint_every;
+    map<int, txTableEntry> tx_copy;
+    map<int, int> pages_copy;
+    size_t start = startCheckpoint(ckpt_record, 0, LSN, NULL_TX);
+    int next = numeric_limits<int>::min();
+    for(bool more = true; more; ){
+        lock_guard<recursive_mutex> tables(table_mutex);
+        map<int, txTableEntry>::iterator it = tx_table.lower_bound(next);
+        for(unsigned n = 0; n < checkpoint_chunk && it != tx_table.end(); ++n, ++it){
+            appendCheckpointTx(ckpt_record, it->first, it->second);
+            if(keep_tables) tx_copy.insert(tx_copy.end(), *it);
+        }
+        more = it != tx_table.end();
+        if(more) next = it->first;
+    }
+    size_t pages = startCheckpointPages(ckpt_record);
+    next = numeric_limits<int>::min();
+    for(bool more = true; more; ){
+        lock_guard<recursive_mutex> tables(table_mutex);
+        map<int, int>::iterator it = dirty_page_table.lower_bound(next);
+        for(unsigned n = 0; n < checkpoint_chunk && it != dirty_page_table.end(); ++n, ++it){
+            appendCheckpointPage(ckpt_record, it->first, it->second);
+            if(keep_tables) pages_copy.insert(pages_copy.end(), *it);
+        }
+        more = it != dirty_page_table.end();
+        if(more) next = it->first;
+    }
+    finishCheckpoint(ckpt_record, start, pages);
+    if(delta){
+        map<int, txTableEntry> tx_changed;
+        map<int, int> pages_changed;
+        vector<int> tx_gone, pages_gone;
+        diffTable(ckpt_tx_table, tx_copy, tx_changed, tx_gone,
+                  [](const txTableEntry& a, const txTableEntry& b){
+                      return a.lastLSN == b.lastLSN && a.status == b.status;
+                  });
+        diffTable(ckpt_dirty_pages, pages_copy, pages_changed, pages_gone,
+                  [](int a, int b){ return a == b; });
+        ckpt_record.clear();
+        appendDeltaCheckpoint(ckpt_record, 0, LSN, NULL_TX, last_ckpt_lsn,
+                              tx_changed, pages_changed, tx_gone, pages_gone);
+    }
+    int LSN2 = logRecord(ckpt_record);
     flushLogTail(LSN2);
-    se->store_master(LSN);
+    LogPosition at;
+    {
+        lock_guard<mutex> flushing(flush_mutex);
+        if(ckpt_position_lsn == LSN) at = ckpt_position;
+    }
+    if(keep_tables){
+        ckpt_tx_table.swap(tx_copy);
+        ckpt_dirty_pages.swap(pages_copy);
+        last_ckpt_lsn = LSN;
+        deltas_since_full = delta ? deltas_since_full + 1 : 0;
+        if(!delta) full_ckpt_lsn = LSN;
+    }
+    se->store_master(LSN, at);
+    //a delta checkpoint needs the ones back to the last full one
+    truncateLog(keep_tables ? full_ckpt_lsn : LSN);
+}
+
+void LogMgr::truncateLog(int checkpointLSN){
+    int keep = checkpointLSN;
+    {
+        lock_guard<recursive_mutex> tables(table_mutex);
+        for(map<int, int>::iterator it = dirty_page_table.begin(); it != dirty_page_table.end(); ++it){
+            keep = min(keep, it->second);
+        }
+        for(map<int, txTableEntry>::iterator it = tx_table.begin(); it != tx_table.end(); ++it){
+            if(it->second.lastLSN == NULL_LSN) continue;
+            map<int, int>::iterator first = tx_first_lsn.find(it->first);
+            //where this one started is unknown, keep everything
+            if(first == tx_first_lsn.end()) return;
+            keep = min(keep, first->second);
+        }
+    }
+    //the log writer must not roll over to a new segment meanwhile
+    lock_guard<mutex> flush(flush_mutex);
+    se->truncateLog(keep);
+}
+
+unsigned LogMgr::beginTableUpdate(){
+    while(true){
+        unsigned epoch = table_epoch;
+        ++tables_in_flight[epoch & 1];
+        if(table_epoch == epoch) return epoch & 1;
+        //a checkpoint moved on meanwhile and may not be waiting for us
+        --tables_in_flight[epoch & 1];
+    }
+}
+
+void LogMgr::endTableUpdate(unsigned slot){
+    --tables_in_flight[slot];
+}
+
+void LogMgr::enableAutoCheckpoint(size_t log_bytes, unsigned interval_ms){
+    lock_guard<recursive_mutex> guard(log_mutex);
+    {
+        lock_guard<mutex> waking(checkpoint_mutex);
+        checkpoint_bytes = log_bytes;
+        checkpoint_interval_ms = interval_ms;
+        stop_checkpointer = false;
+        auto_checkpoint = true;
+    }
+    checkpoint_cv.notify_one();
+    if(!checkpointer.joinable()){
+        checkpointer = thread(&LogMgr::checkpointScheduler, this);
+    }
+}
+
+void LogMgr::checkpointScheduler(){
+    unique_lock<mutex> lock(checkpoint_mutex);
+    function<bool()> due = [this]{
+        return stop_checkpointer || (checkpoint_bytes && bytes_since_checkpoint >= checkpoint_bytes);
+    };
+    while(!stop_checkpointer){
+        if(checkpoint_interval_ms) checkpoint_cv.wait_for(lock, chrono::milliseconds(checkpoint_interval_ms), due);
+        else checkpoint_cv.wait(lock, due);
+        if(stop_checkpointer) break;
+        //nothing logged since the last one
+        if(bytes_since_checkpoint == 0) continue;
+        lock.unlock();
+        fuzzyCheckpoint();
+        lock.lock();
+    }
+}
+
+void LogMgr::stopAutoCheckpoint(){
+    {
+        lock_guard<mutex> waking(checkpoint_mutex);
+        stop_checkpointer = true;
+    }
+    checkpoint_cv.notify_one();
+    if(checkpointer.joinable()) checkpointer.join();
+}
+
+const unsigned LogMgr::cleaner_batch;
+const unsigned LogMgr::cleaner_interval_ms;
+
+void LogMgr::enablePageCleaner(double target_dirty_ratio, int max_redo_distance){
+    lock_guard<recursive_mutex> guard(log_mutex);
+    {
+        lock_guard<mutex> waking(cleaner_mutex);
+        cleaner_dirty_ratio = target_dirty_ratio;
+        cleaner_redo_distance = max_redo_distance;
+        stop_cleaner = false;
+    }
+    if(!cleaner.joinable()){
+        cleaner = thread(&LogMgr::pageCleaner, this);
+    }
+}
+
+void LogMgr::pageCleaner(){
+    unique_lock<mutex> lock(cleaner_mutex);
+    while(true){
+        cleaner_cv.wait_for(lock, chrono::milliseconds(cleaner_interval_ms), [this]{ return stop_cleaner; });
+        if(stop_cleaner) break;
+        lock.unlock();
+        cleanPages();
+        lock.lock();
+    }
+}
+
+void LogMgr::cleanPages(){
+    double ratio;
+    int distance;
+    {
+        lock_guard<mutex> waking(cleaner_mutex);
+        ratio = cleaner_dirty_ratio;
+        distance = cleaner_redo_distance;
+    }
+    vector<pair<int, int> > byRecLSN; //recLSN, page_id
+    {
+        lock_guard<recursive_mutex> tables(table_mutex);
+        for(map<int, int>::iterator it = dirty_page_table.begin(); it != dirty_page_table.end(); ++it){
+            byRecLSN.push_back(make_pair(it->second, it->first));
+        }
+    }
+    sort(byRecLSN.begin(), byRecLSN.end());
+    int current = se->currentLSN();
+    unsigned dirty = se->dirtyFrames();
+    unsigned target = ratio * se->frameCount();
+    for(unsigned i = 0; i < byRecLSN.size(); ){
+        bool too_old = distance > 0 && current - byRecLSN[i].first > distance;
+        if(!too_old && dirty <= target) break;
+        //one force covers the whole batch; cleanPage's own pageFlushed
+        //then finds nothing left to write
+        flushLogTail(numeric_limits<int>::max());
+        for(unsigned n = 0; n < cleaner_batch && i < byRecLSN.size(); ++n, ++i){
+            if(se->cleanPage(byRecLSN[i].second) && dirty > 0) --dirty;
+        }
+    }
+}
+
+void LogMgr::pageCleaned(int page_id){
+    if(restart_redo_pending){
+        //not redone yet, so the disk does not have it
+        lock_guard<mutex> pending(restart_mutex);
+        if(pending_redo.count(page_id)) return;
+    }
+    lock_guard<recursive_mutex> tables(table_mutex);
+    dirty_page_table.erase(page_id);
+}
+
+void LogMgr::stopPageCleaner(){
+    {
+        lock_guard<mutex> waking(cleaner_mutex);
+        stop_cleaner = true;
+    }
+    cleaner_cv.notify_one();
+    if(cleaner.joinable()) cleaner.join();
 }
 
 /*
  * Commit the specified transaction.
  */
 void LogMgr::commit(int txid){
-    int LSN = se->nextLSN();
-    logtail.push_back(new LogRecord(LSN, getLastLSN(txid), txid, COMMIT));
+    txNeeded(txid);
+    lock_guard<recursive_mutex> guard(log_mutex);
+    record.clear();
+    appendRecord(record, 0, getLastLSN(txid), txid, COMMIT);
+    int LSN = logRecord(record);
     flushLogTail(LSN);
-    tx_table.erase(txid);
-    int LSN2 = se->nextLSN();
-    logtail.push_back(new LogRecord(LSN2, LSN, txid, END));
+    endTx(txid);
+    record.clear();
+    appendRecord(record, 0, LSN, txid, END);
+    logRecord(record);
+}
+
+/*
+ * Starts the flusher thread used by commitAsync.
+ */
+void LogMgr::enableGroupCommit(unsigned window_us, unsigned max_batch){
+    lock_guard<recursive_mutex> guard(log_mutex);
+    commit_window_us = window_us;
+    commit_max_batch = max_batch ? max_batch : 1;
+    if(!flusher.joinable()){
+        stop_flusher = false;
+        flusher = thread(&LogMgr::groupCommitFlusher, this);
+    }
+}
+
+/*
+ * Writes the commit record and queues the transaction for the flusher.
+ */
+void LogMgr::commitAsync(int txid, function<void(int)> done){
+    txNeeded(txid);
+    lock_guard<recursive_mutex> guard(log_mutex);
+    record.clear();
+    appendRecord(record, 0, getLastLSN(txid), txid, COMMIT);
+    int LSN = logRecord(record);
+    PendingCommit pc = {txid, LSN, done};
+    pending_commits.push_back(pc);
+    commit_cv.notify_all();
+}
+
+future<int> LogMgr::commitAsync(int txid){
+    shared_ptr<promise<int> > p = make_shared<promise<int> >();
+    commitAsync(txid, [p](int lsn){ p->set_value(lsn); });
+    return p->get_future();
+}
+
+void LogMgr::groupCommitFlusher(){
+    unique_lock<recursive_mutex> lock(log_mutex);
+    while(true){
+        commit_cv.wait(lock, [this]{ return stop_flusher || !pending_commits.empty(); });
+        if(pending_commits.empty()) return;
+        //give other committers the rest of the window to join the batch
+        if(!stop_flusher && pending_commits.size() < commit_max_batch){
+            commit_cv.wait_for(lock, chrono::microseconds(commit_window_us), [this]{
+                return stop_flusher || pending_commits.size() >= commit_max_batch;
+            });
+        }
+        vector<PendingCommit> batch;
+        int maxLSN = NULL_LSN;
+        while(!pending_commits.empty() && batch.size() < commit_max_batch){
+            batch.push_back(pending_commits.front());
+            pending_commits.pop_front();
+            maxLSN = max(maxLSN, batch.back().lsn);
+        }
+        //one force makes every commit record in the batch durable
+        flushLogTail(maxLSN);
+        for(unsigned i = 0; i < batch.size(); ++i){
+            endTx(batch[i].txid);
+            record.clear();
+            appendRecord(record, 0, batch[i].lsn, batch[i].txid, END);
+            logRecord(record);
+        }
+        lock.unlock();
+        for(unsigned i = 0; i < batch.size(); ++i){
+            if(batch[i].done) batch[i].done(batch[i].lsn);
+        }
+        lock.lock();
+    }
+}
+
+void LogMgr::stopGroupCommit(){
+    {
+        lock_guard<recursive_mutex> guard(log_mutex);
+        stop_flusher = true;
+        commit_cv.notify_all();
+    }
+    if(flusher.joinable()) flusher.join();
 }
 
 /*
@@ -249,36 +1053,198 @@ void LogMgr::pageFlushed(int page_id){
  * Recover from a crash, given the log from the disk.
  */
 void LogMgr::recover(string log){
-    vector<LogRecord*> v = stringToLRVector(log);
+    lock_guard<recursive_mutex> guard(log_mutex);
+    if(instant_restart){
+        instantRecover(stringToRecords(log));
+        return;
+    }
+    LogView v(stringToRecords(log));
     analyze(v);
     if(!redo(v)) return;
     undo(v);
 }
 
+void LogMgr::instantRecover(string&& log){
+    restart_log.reset(new LogView(std::move(log)));
+    const LogView& v = *restart_log;
+    analyze(v);
+    for(int i = firstDirtyPosition(v); i < (int)v.size(); ++i){
+        LogRecordView rec = v[i];
+        if(rec.getType() != UPDATE && rec.getType() != CLR) continue;
+        map<int, int>::iterator dp = dirty_page_table.find(rec.getPageID());
+        if(dp == dirty_page_table.end() || dp->second > rec.getLSN()) continue;
+        pending_redo[rec.getPageID()].push_back(i);
+    }
+    endCommitted();
+    //the pages undo will write, following each loser's chain as undo would
+    for(map<int, txTableEntry>::iterator it = tx_table.begin(); it != tx_table.end(); it++){
+        restart_losers.insert(it->first);
+        for(LogRecordView rec = v.find(it->second.lastLSN); rec.valid(); ){
+            int next = rec.getprevLSN();
+            if(rec.getType() == UPDATE) loser_pages.insert(rec.getPageID());
+            if(rec.getType() == CLR) next = rec.getUndoNextLSN();
+            if(next == NULL_LSN) break;
+            rec = v.find(next);
+        }
+    }
+    restart_redo_pending = !pending_redo.empty();
+    restart_undo_pending = !restart_losers.empty();
+    releaseRestartLog();
+}
+
+void LogMgr::redoPage(int page_id, const function<void(const LogRecordView&)>& apply){
+    if(!restart_redo_pending) return;
+    lock_guard<mutex> pending(restart_mutex);
+    unordered_map<int, vector<int> >::iterator it = pending_redo.find(page_id);
+    if(it == pending_redo.end()) return;
+    for(unsigned j = 0; j < it->second.size(); ++j){
+        apply((*restart_log)[it->second[j]]);
+    }
+    pending_redo.erase(it);
+    if(pending_redo.empty()){
+        restart_redo_pending = false;
+        if(!restart_undo_pending) restart_log.reset();
+    }
+}
+
+void LogMgr::pageNeeded(int txid, int page_id){
+    if(!restart_undo_pending) return;
+    lock_guard<mutex> undoing(restart_undo_mutex);
+    if(!loser_pages.count(page_id) && !restart_losers.count(txid)) return;
+    rollBackLosers();
+}
+
+void LogMgr::txNeeded(int txid){
+    if(!restart_undo_pending) return;
+    lock_guard<mutex> undoing(restart_undo_mutex);
+    if(restart_losers.count(txid)) rollBackLosers();
+}
+
+void LogMgr::rollBackLosers(){
+    if(!restart_undo_pending) return;
+    vector<LogRecordView> from;
+    {
+        lock_guard<recursive_mutex> tables(table_mutex);
+        for(set<int>::iterator l = restart_losers.begin(); l != restart_losers.end(); ++l){
+            map<int, txTableEntry>::iterator it = tx_table.find(*l);
+            if(it == tx_table.end()) continue;
+            LogRecordView rec = restart_log->find(it->second.lastLSN);
+            if(rec.valid()) from.push_back(rec);
+        }
+    }
+    rollBack(*restart_log, from, NULL_LSN, false);
+    restart_losers.clear();
+    loser_pages.clear();
+    restart_undo_pending = false;
+    releaseRestartLog();
+}
+
+void LogMgr::finishRestart(){
+    {
+        lock_guard<mutex> undoing(restart_undo_mutex);
+        rollBackLosers();
+    }
+    if(!restart_redo_pending) return;
+    vector<int> pages;
+    {
+        lock_guard<mutex> pending(restart_mutex);
+        for(unordered_map<int, vector<int> >::iterator it = pending_redo.begin(); it != pending_redo.end(); ++it){
+            if(it->first >= 1 && it->first <= se->pageCount()) pages.push_back(it->first);
+        }
+    }
+    //reading a page into the buffer redoes it
+    unsigned ahead = 1;
+    for(unsigned i = 0; i < pages.size(); ++i){
+        for(; ahead < pages.size() && ahead <= i + redo_read_ahead; ++ahead){
+            se->prefetchPage(pages[ahead]);
+        }
+        se->getLSN(pages[i]);
+    }
+}
+
+/*
+ * Frees the log an instant restart kept once nothing is deferred.
+ */
+void LogMgr::releaseRestartLog(){
+    lock_guard<mutex> pending(restart_mutex);
+    if(!restart_redo_pending && !restart_undo_pending) restart_log.reset();
+}
+
+void LogMgr::setInstantRestart(bool on){
+    lock_guard<recursive_mutex> guard(log_mutex);
+    instant_restart = on;
+}
+
 /*
  * Logs an update to the database and updates tables if needed.
  */
-int LogMgr::write(int txid, int page_id, int offset, string input, string oldtext){
-    int LSN = se->nextLSN();
-    if(!tx_table.count(txid)) setLastLSN(txid, NULL_LSN);
-    logtail.push_back(new UpdateLogRecord(LSN, getLastLSN(txid), txid, page_id, offset, oldtext, input));
-    setLastLSN(txid, LSN);
-    tx_table[txid].status = U;
-    if(!dirty_page_table.count(page_id)) dirty_page_table[page_id] = LSN;
+int LogMgr::write(int txid, int page_id, int offset, const string& input, const string& oldtext){
+    //each writer thread builds its records in its own buffer
+    static thread_local string rec;
+    int prevLSN;
+    {
+        lock_guard<recursive_mutex> tables(table_mutex);
+        if(!tx_table.count(txid)) tx_table[txid].lastLSN = NULL_LSN;
+        prevLSN = tx_table[txid].lastLSN;
+    }
+    rec.clear();
+    if(delta_logging && se->getLogFormat() == BINARY_LOG){
+        appendDeltaUpdate(rec, 0, prevLSN, txid, page_id, offset, imageOf(oldtext), imageOf(input));
+    }
+    else{
+        appendUpdate(rec, 0, prevLSN, txid, page_id, offset, imageOf(oldtext), imageOf(input));
+    }
+    unsigned slot = beginTableUpdate();
+    int LSN = logRecord(rec);
+    {
+        lock_guard<recursive_mutex> tables(table_mutex);
+        cacheUndo(txid, LogRecordView(rec.data()));
+        if(prevLSN == NULL_LSN) tx_first_lsn[txid] = LSN;
+        tx_table[txid].lastLSN = LSN;
+        tx_table[txid].status = U;
+        if(!dirty_page_table.count(page_id)) dirty_page_table[page_id] = LSN;
+    }
+    endTableUpdate(slot);
     return LSN;
 }
 
+int LogMgr::write(int txid, const PageWrite* writes, const string* oldtexts, size_t n){
+    static thread_local string recs;
+    int prevLSN;
+    {
+        lock_guard<recursive_mutex> tables(table_mutex);
+        if(!tx_table.count(txid)) tx_table[txid].lastLSN = NULL_LSN;
+        prevLSN = tx_table[txid].lastLSN;
+    }
+    recs.clear();
+    bool delta = delta_logging && se->getLogFormat() == BINARY_LOG;
+    for(size_t k = 0; k < n; ++k){
+        ImageRef after = {writes[k].data, writes[k].length};
+        //logRecord chains the ones after the first
+        if(delta) appendDeltaUpdate(recs, 0, prevLSN, txid, writes[k].page_id, writes[k].offset, imageOf(oldtexts[k]), after);
+        else appendUpdate(recs, 0, prevLSN, txid, writes[k].page_id, writes[k].offset, imageOf(oldtexts[k]), after);
+    }
+    unsigned slot = beginTableUpdate();
+    int first = logRecord(recs);
+    {
+        lock_guard<recursive_mutex> tables(table_mutex);
+        for(size_t at = 0; at < recs.size(); at += LogRecordView(&recs[at]).length()){
+            cacheUndo(txid, LogRecordView(&recs[at]));
+        }
+        if(prevLSN == NULL_LSN) tx_first_lsn[txid] = first;
+        tx_table[txid].lastLSN = first + (int)n - 1;
+        tx_table[txid].status = U;
+        for(size_t k = 0; k < n; ++k){
+            if(!dirty_page_table.count(writes[k].page_id)) dirty_page_table[writes[k].page_id] = first + (int)k;
+        }
+    }
+    endTableUpdate(slot);
+    return first;
+}
+
 /*
  * Sets this.se to engine. 
  */
 void LogMgr::setStorageEngine(StorageEngine* engine){
     this->se = engine;
 }
-
-//Given a vector of Records and a LSN, returns the index of the record with that LSN
-int findLSN(vector <LogRecord*> log, int LSN){
-    for(int i = 0; i < log.size(); ++i){
-        if(log[i]->getLSN() == LSN) return i;
-    }
-    return -1; 
-}
\ No newline at end of file
@@ -2,7 +2,21 @@
 #define LOGMGR_H_
 
 #include "LogRecord.h"
+#include "LogReader.h"
+#include "LogView.h"
+#include "LogTail.h"
 #include <vector>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <limits>
+#include <memory>
+#include <atomic>
+#include <set>
+#include <unordered_map>
 #include "../StorageEngine/StorageEngine.h"
 
 using namespace std;
@@ -19,7 +33,41 @@ class LogMgr {
  private:
   map <int, txTableEntry> tx_table;
   map <int, int> dirty_page_table;
-  vector <LogRecord*> logtail; 
+  //LSN of each transaction's first record, so a segmented log
+  //is never truncated past a transaction that may still roll back
+  map <int, int> tx_first_lsn;
+  //records not yet on disk, in the binary format of LogCodec.h
+  //(crc not filled in); flushLogTail drains it from the front
+  LogTail logtail;
+  string record; //the record being built under log_mutex
+  string flush_text; //scratch buffer for flushing a text log
+
+  /*
+   * Gives the encoded record in rec the next LSN, stores it in the
+   * logtail and returns the LSN. LSNs are handed out in logtail order,
+   * so flushLogTail can stop at the first LSN past its limit. A record
+   * larger than the whole logtail is forced to disk directly once
+   * everything before it has been.
+   * rec may hold several records of one transaction; they get
+   * consecutive LSNs with one reservation, each after the first has
+   * the one before it as prevLSN, and the first LSN is returned.
+   */
+  int logRecord(string& rec);
+
+  /*
+   * Hands len bytes of records to the StorageEngine's log buffer,
+   * converted to text if the log is a text log.
+   */
+  void appendRecords(char* recs, size_t len);
+
+  /*
+   * Where the last begin_checkpoint went in the log, for the master
+   * record; set by appendRecords (under flush_mutex), offset bytes
+   * past what the log buffer held.
+   */
+  LogPosition ckpt_position;
+  int ckpt_position_lsn = NULL_LSN;
+  void noteCheckpoint(const LogRecordView& rec, size_t offset);
 
   /*
    * Find the LSN of the most recent log record for this TX.
@@ -46,22 +94,302 @@ class LogMgr {
   /* 
    * Run the analysis phase of ARIES.
    */
-  void analyze(vector <LogRecord*> log);
+  void analyze(const LogView& log);
 
   /*
    * Run the redo phase of ARIES.
    * If the StorageEngine stops responding, return false.
    * Else when redo phase is complete, return true. 
    */
-  bool redo(vector <LogRecord*> log);
+  bool redo(const LogView& log);
+
+  /*
+   * The redo loop of redo() spread over redo_threads threads by
+   * page_id. Returns false where the sequential loop would.
+   */
+  bool parallelRedo(const LogView& log, int firstDirty);
+  bool redoCandidate(const LogRecordView& rec);
+  unsigned redo_threads = 1;
+  unsigned redo_read_ahead = 0;
 
   /*
    * If no txnum is specified, run the undo phase of ARIES.
    * If a txnum is provided, abort that transaction.
    * Hint: the logic is very similar for these two tasks!
    */
-  void undo(vector <LogRecord*> log, int txnum = NULL_TX);
-  vector<LogRecord*> stringToLRVector(string logstring);
+  void undo(const LogView& log, int txnum = NULL_TX);
+
+  /*
+   * The undo loop: rolls back from the given records, newest LSN
+   * first, writing CLRs, until only records at or below stopLSN are
+   * left. Returns false if the StorageEngine stops responding.
+   * Unbudgeted page writes (restartWrite) are for work deferred past
+   * the end of recover().
+   */
+  bool rollBack(const LogView& log, const vector<LogRecordView>& from, int stopLSN,
+		bool budgeted = true);
+
+  /*
+   * The undo phase spread over undo_threads threads. Losers that
+   * touched a common page are rolled back by the same thread, so
+   * every page sees its before images in the sequential order.
+   */
+  void parallelUndo(const LogView& log);
+  unsigned undo_threads = 1;
+
+  /*
+   * Writes END records for the committed transactions left in
+   * tx_table after analysis and drops them from it.
+   */
+  void endCommitted();
+
+  /*
+   * Where redo starts: the log position of the smallest recLSN in
+   * the dirty page table, or log.size() if it is empty.
+   */
+  int firstDirtyPosition(const LogView& log);
+
+  /*
+   * Instant restart (see setInstantRestart): analysis only. Redo
+   * records are sorted out per page for redoPage, and the pages the
+   * losers wrote are noted for pageNeeded. Nothing is written to a
+   * page, so the page write budget of the crash is not used.
+   */
+  void instantRecover(string&& log);
+  bool instant_restart = false;
+  unique_ptr<LogView> restart_log; //kept until all deferred work is done
+  unordered_map<int, vector<int> > pending_redo; //page_id -> positions in restart_log
+  atomic<bool> restart_redo_pending{false};
+  set<int> restart_losers;
+  set<int> loser_pages;
+  atomic<bool> restart_undo_pending{false};
+  void releaseRestartLog();
+
+  /*
+   * Rolls back the losers of an instant restart that are still in
+   * tx_table; the caller holds restart_undo_mutex.
+   */
+  void rollBackLosers();
+
+  /*
+   * Before txid commits or aborts: if it is a loser of an instant
+   * restart, rolls back the losers first, so txid is a new transaction.
+   */
+  void txNeeded(int txid);
+
+  /*
+   * Turns the log read from disk into back to back binary records.
+   * A binary log only loses its file header and any torn record at
+   * its end; a text log is parsed line by line.
+   */
+  string stringToRecords(string logstring);
+
+  /*
+   * Read the on-disk log by LSN, one per log file (segment);
+   * each is created the first time it is needed.
+   */
+  map<string, LogReader*> readers;
+  LogReader* readerFor(int lsn);
+
+  /*
+   * Lets the StorageEngine drop log segments that hold nothing
+   * recovery or a rollback could need: everything before the last
+   * checkpoint, the oldest recLSN and the oldest active transaction.
+   */
+  void truncateLog(int checkpointLSN);
+
+  /*
+   * Reads back the records of one transaction, newest first, starting
+   * at lastLSN and following prevLSN, as back to back binary records.
+   */
+  string readTxChain(int lastLSN);
+
+  /*
+   * The records this LogMgr wrote for each live transaction, oldest
+   * first and encoded like the logtail, so an abort can build its CLRs
+   * without reading the log. Updates are kept without their after
+   * image (delta updates as they are). A record that would push the
+   * cache past undo_cache_limit bytes drops its transaction's chain;
+   * that transaction then aborts from the on-disk log instead.
+   */
+  map <int, string> undo_chains;
+  size_t undo_cache_bytes = 0;
+  size_t undo_cache_limit = 1 << 20;
+  bool delta_logging = false;
+
+  void cacheUndo(int txid, const LogRecordView& rec);
+  void dropUndoChain(int txid);
+
+  /*
+   * Removes a finished transaction from tx_table and its undo chain.
+   */
+  void endTx(int txid);
+
+  /*
+   * Copies txid's chain out of undo_chains. Returns false if the
+   * chain is missing or does not reach back to the transaction's
+   * first record.
+   */
+  bool cachedTxChain(int txid, string& chain);
+
+  /*
+   * Locks, always taken in this order:
+   *
+   *   checkpointing one checkpoint at a time, manual or automatic.
+   *   restart_undo_mutex  the deferred rollback of restart losers,
+   *                 taken by pageNeeded before the writer latches
+   *                 its page.
+   *   log_mutex     commit, abort, checkpoint and recovery, one at a
+   *                 time. Recursive because recovery calls back in
+   *                 through StorageEngine. write() does not take it,
+   *                 so transactions on different threads write
+   *                 concurrently.
+   *   table_mutex   tx_table, dirty_page_table and undo_chains, held
+   *                 for a few map operations and never across a call
+   *                 into StorageEngine.
+   *   append_mutex  hands out the next LSN together with its logtail
+   *                 space; the copy into the logtail happens outside.
+   *   flush_mutex   one flushLogTail at a time; pageFlushed only needs
+   *                 this one, so an eviction never waits for log_mutex.
+   *   restart_mutex pending_redo, from redoPage, which StorageEngine
+   *                 calls holding the pool and the frame latch;
+   *                 nothing is locked under it.
+   *   checkpoint_mutex, cleaner_mutex  wake the background threads;
+   *                 nothing is locked under them.
+   */
+  mutex checkpointing;
+  mutex restart_undo_mutex;
+  recursive_mutex log_mutex;
+  recursive_mutex table_mutex;
+  mutex append_mutex;
+  mutex flush_mutex;
+  mutex restart_mutex;
+  mutex checkpoint_mutex;
+  mutex cleaner_mutex;
+
+  //Group commit state, see enableGroupCommit.
+  struct PendingCommit {
+    int txid;
+    int lsn;
+    function<void(int)> done;
+  };
+  deque<PendingCommit> pending_commits;
+  condition_variable_any commit_cv;
+  thread flusher;
+  bool stop_flusher = false;
+  unsigned commit_window_us = 0;
+  unsigned commit_max_batch = 1;
+
+  /*
+   * Body of the flusher thread: waits for commits, then forces the
+   * log once for the whole batch and completes every commit in it.
+   */
+  void groupCommitFlusher();
+
+  /*
+   * Completes every pending commit and joins the flusher thread.
+   */
+  void stopGroupCommit();
+
+  /*
+   * Writes a fuzzy checkpoint. begin_checkpoint is logged first; once
+   * the table updates of every record logged before it have landed,
+   * tx_table and dirty_page_table are copied into end_checkpoint
+   * checkpoint_chunk entries at a time, letting go of table_mutex in
+   * between, so writers never wait for a whole copy. Analysis replays
+   * the log from begin_checkpoint, which covers whatever changed while
+   * the copy ran. The log is forced, then the master record moves to
+   * the new begin_checkpoint.
+   */
+  void fuzzyCheckpoint();
+  static const unsigned checkpoint_chunk = 64;
+  string ckpt_record; //the end_checkpoint being built, under checkpointing
+
+  /*
+   * Delta checkpoints (see setDeltaCheckpoints), under checkpointing:
+   * the tables the last checkpoint of this run stood for, where it
+   * began, and where the full checkpoint its chain starts from began.
+   */
+  unsigned full_checkpoint_every = 0;
+  unsigned deltas_since_full = 0;
+  int last_ckpt_lsn = NULL_LSN;
+  int full_ckpt_lsn = NULL_LSN;
+  map<int, txTableEntry> ckpt_tx_table;
+  map<int, int> ckpt_dirty_pages;
+
+  /*
+   * Position of the end_checkpoint of the checkpoint that began at
+   * begin_lsn, log.size() if it is not in the log.
+   */
+  int checkpointEnd(const LogView& log, int begin_lsn);
+
+  /*
+   * Loads tx_table and dirty_page_table from the end_checkpoint at
+   * endNum, following a delta checkpoint back to the full one it
+   * builds on. Returns false if one of them is not in the log.
+   */
+  bool loadCheckpoint(const LogView& log, int endNum);
+
+  /*
+   * Brackets a log record and the table updates that go with it,
+   * so fuzzyCheckpoint can wait for the ones logged before its
+   * begin_checkpoint. Writers count themselves in the slot of the
+   * current epoch; a checkpoint moves to the next epoch and waits for
+   * the old slot to empty.
+   */
+  unsigned beginTableUpdate();
+  void endTableUpdate(unsigned slot);
+  atomic<unsigned> table_epoch{0};
+  atomic<int> tables_in_flight[2] = {};
+
+  //Automatic checkpoint state, see enableAutoCheckpoint.
+  thread checkpointer;
+  condition_variable checkpoint_cv;
+  bool stop_checkpointer = false;
+  atomic<bool> auto_checkpoint{false}; //count log bytes for the checkpointer
+  atomic<size_t> checkpoint_bytes{0};
+  unsigned checkpoint_interval_ms = 0;
+  atomic<size_t> bytes_since_checkpoint{0};
+
+  /*
+   * Body of the checkpointer thread: checkpoints every
+   * checkpoint_interval_ms, or sooner once checkpoint_bytes of log
+   * records have been written since the last checkpoint.
+   */
+  void checkpointScheduler();
+
+  /*
+   * Joins the checkpointer thread.
+   */
+  void stopAutoCheckpoint();
+
+  //Page cleaner state, see enablePageCleaner.
+  thread cleaner;
+  condition_variable cleaner_cv;
+  bool stop_cleaner = false;
+  double cleaner_dirty_ratio = 1;
+  int cleaner_redo_distance = 0;
+  static const unsigned cleaner_batch = 16;
+  static const unsigned cleaner_interval_ms = 10;
+
+  /*
+   * Body of the cleaner thread: runs cleanPages every
+   * cleaner_interval_ms until stopped.
+   */
+  void pageCleaner();
+
+  /*
+   * Writes back pages in recLSN order, cleaner_batch at a time with
+   * one log force per batch, until the dirty frames are within
+   * cleaner_dirty_ratio of the buffer and no dirty page table entry
+   * is older than cleaner_redo_distance LSNs.
+   */
+  void cleanPages();
+
+  /*
+   * Joins the cleaner thread.
+   */
+  void stopPageCleaner();
   
  public:
   /*
@@ -70,6 +398,93 @@ class LogMgr {
    */
   void abort(int txid);
 
+  /*
+   * Caps the memory used for in-memory undo chains (1 MB by default).
+   */
+  void setUndoCacheLimit(size_t bytes);
+
+  /*
+   * If on, updates are logged as a delta of the changed bytes instead
+   * of their before and after images, and their CLRs repeat the delta
+   * (see LogCodec.h). Only a binary log can hold deltas; with a text
+   * log this changes nothing. Off by default.
+   */
+  void setDeltaLogging(bool on);
+
+  /*
+   * If full_every is above 1, a checkpoint logs only the entries of
+   * tx_table and dirty_page_table that changed since the checkpoint
+   * before it (see LogCodec.h), and every full_every-th one logs the
+   * whole tables, so analysis never reads more than full_every
+   * end_checkpoints. The first checkpoint after a restart is full.
+   * Only a binary log can hold delta checkpoints; with a text log
+   * this changes nothing. 0 (the default) logs the whole tables.
+   */
+  void setDeltaCheckpoints(unsigned full_every);
+
+  /*
+   * Number of threads redo uses after a crash; 1 (the default) redoes
+   * in one loop. Any number gives the same page contents and the same return
+   * value, including when the page write budget runs out.
+   */
+  void setRedoThreads(unsigned threads);
+
+  /*
+   * While redo works on a record, asks the StorageEngine to read in
+   * the pages of the next records records it will look at (see
+   * StorageEngine::prefetchPage), and an instant restart's last pass
+   * over the pages it deferred does the same. Takes effect with I/O
+   * threads in the StorageEngine; 0 (the default) reads no page ahead.
+   * Redo with more than one thread does not read ahead.
+   */
+  void setRedoReadAhead(unsigned records);
+
+  /*
+   * Number of threads the undo phase of recovery uses to roll back
+   * loser transactions; 1 (the default) undoes in one loop. The pages
+   * and the records undone come out the same for any number, but the
+   * CLRs of different losers can interleave differently in the log.
+   */
+  void setUndoThreads(unsigned threads);
+
+  /*
+   * If on, recover() stops after analysis and the engine takes new
+   * transactions right away. The rest of recovery is done on demand:
+   * a page is redone when StorageEngine first reads it into the
+   * buffer (redoPage), and the losers are rolled back the first time
+   * a transaction is about to write a page one of them wrote
+   * (pageNeeded). Deferred writes do not count against the page
+   * write budget; that belongs to the crash, which is over by then.
+   */
+  void setInstantRestart(bool on);
+
+  /*
+   * Called by StorageEngine with a page it has just read into the
+   * buffer, holding the frame latch. apply gets each record still to
+   * be redone on that page, oldest first.
+   */
+  void redoPage(int page_id, const function<void(const LogRecordView&)>& apply);
+
+  /*
+   * Called by StorageEngine before txid writes page_id. Rolls back the
+   * losers of an instant restart first if one of them wrote the page,
+   * or if txid is one of them (the id starts a new transaction, as it
+   * would once recovery had run to the end).
+   */
+  void pageNeeded(int txid, int page_id);
+
+  /*
+   * Does whatever an instant restart still has deferred: rolls back
+   * the remaining losers and redoes the pages not read since.
+   */
+  void finishRestart();
+
+  /*
+   * Resizes the logtail ring (1 MB by default). A writer that finds
+   * it full flushes it before going on. Flushes the logtail first.
+   */
+  void setLogTailCapacity(size_t bytes);
+
   /*
    * Write the begin checkpoint and end checkpoint
    */
@@ -80,6 +495,54 @@ class LogMgr {
    */
   void commit(int txid);
 
+  /*
+   * Starts group commit: a background thread forces the log for all
+   * commits that arrive within window_us microseconds of the first
+   * one, or as soon as max_batch commits are waiting, whichever comes
+   * first. Only commitAsync goes through the flusher; commit() still
+   * forces the log itself.
+   */
+  void enableGroupCommit(unsigned window_us, unsigned max_batch);
+
+  /*
+   * Starts a background thread that checkpoints whenever log_bytes of
+   * log records have been written since the last checkpoint, and at
+   * least every interval_ms milliseconds; 0 turns either trigger off.
+   * Calling it again changes the triggers.
+   */
+  void enableAutoCheckpoint(size_t log_bytes, unsigned interval_ms);
+
+  /*
+   * Starts a background thread that writes dirty pages back without
+   * evicting them, oldest recLSN first, whenever more than
+   * target_dirty_ratio of the buffer frames are dirty or a dirty page
+   * table entry is more than max_redo_distance LSNs old (0 for no
+   * limit). Cleaned pages leave the dirty page table, so checkpoints
+   * record newer recLSNs and redo starts later in the log.
+   * Calling it again changes the targets.
+   */
+  void enablePageCleaner(double target_dirty_ratio, int max_redo_distance);
+
+  /*
+   * StorageEngine::cleanPage calls this once page_id is the same on
+   * disk as in the buffer, holding its frame latch; the page leaves
+   * the dirty page table until it is written again.
+   */
+  void pageCleaned(int page_id);
+
+  /*
+   * Writes the commit record for txid and hands it to the flusher.
+   * done is called with the commit LSN, from the flusher thread, once
+   * the commit record is on disk and the end record has been written
+   * to the logtail. Requires enableGroupCommit.
+   */
+  void commitAsync(int txid, function<void(int)> done);
+
+  /*
+   * Same as above; the future becomes ready with the commit LSN.
+   */
+  future<int> commitAsync(int txid);
+
   /*
    * A function that StorageEngine will call when it's about to 
    * write a page to disk. 
@@ -94,67 +557,47 @@ class LogMgr {
 
   /*
    * Logs an update to the database and updates tables if needed.
+   * Safe to call from many threads at once, one thread per
+   * transaction; the caller holds the page's frame latch.
    */
-  int write(int txid, int page_id, int offset, string input, string oldtext);
+  int write(int txid, int page_id, int offset, const string& input, const string& oldtext);
+
+  /*
+   * Logs n writes of txid (see StorageEngine::write) with one logtail
+   * reservation; oldtexts[k] is what writes[k] overwrote. Returns the
+   * LSN of the first one; writes[k] gets that LSN plus k. The caller
+   * holds the latches of all their pages.
+   */
+  int write(int txid, const PageWrite* writes, const string* oldtexts, size_t n);
 
   /*
    * Sets this.se to engine. 
    */
   void setStorageEngine(StorageEngine* engine);
 
+  LogMgr() {
+    logtail.setDrain([this]{ flushLogTail(numeric_limits<int>::max()); });
+  }
+
   //destructor
   ~LogMgr() {
-    while (!logtail.empty()) {
-      delete logtail[0];
-      logtail.erase(logtail.begin());
-    }
+    stopPageCleaner();
+    stopAutoCheckpoint();
+    stopGroupCommit();
+    for(map<string, LogReader*>::iterator it = readers.begin(); it != readers.end(); ++it) delete it->second;
   }
   //copy constructor omitted
   //Overloaded assignment operator
   LogMgr &operator= (const LogMgr &rhs) {
     if (this == &rhs) return *this;
-    //delete anything in the logtail vector
-    while (!logtail.empty()) {
-      delete logtail[0];
-      logtail.erase(logtail.begin());
-    }
-    for (vector<LogRecord*>::const_iterator it = rhs.logtail.begin(); it !=rhs.logtail.end(); ++it) {
-      LogRecord * lr = *it;
-      int lsn = lr->getLSN();
-      int prevLSN = lr->getprevLSN();
-      int txid = lr->getTxID();
-      TxType type = lr->getType();
-      if (type == UPDATE) {
-	UpdateLogRecord* ulr = dynamic_cast<UpdateLogRecord *>(lr);
-	int page_id = ulr->getPageID();
-	int offset  = ulr->getOffset();
-	string before = ulr->getBeforeImage();
-	string after = ulr->getAfterImage();
-	UpdateLogRecord* cpy_lr = new UpdateLogRecord(lsn, prevLSN, txid, page_id, offset, 
-						      before, after);
-	logtail.push_back(cpy_lr);
-      } else if (type == CLR) {
-	CompensationLogRecord* clr = dynamic_cast<CompensationLogRecord *>(lr);
-	int page_id = clr->getPageID();
-	int offset  = clr->getOffset();
-	string after = clr->getAfterImage();
-	int nextLSN = clr->getUndoNextLSN();
-	CompensationLogRecord* cpy_lr = new CompensationLogRecord(lsn, prevLSN, txid, page_id, offset, 
-								  after, nextLSN);
-	logtail.push_back(cpy_lr);
-      } else if (type == END_CKPT) {
-	ChkptLogRecord * chk_ptr = dynamic_cast<ChkptLogRecord *>(lr);
-	map <int, txTableEntry> tx_table = chk_ptr->getTxTable();
-	map <int, int> dp_table = chk_ptr->getDirtyPageTable();
-	ChkptLogRecord * cpy_lr = new ChkptLogRecord(lsn, prevLSN, txid, tx_table, dp_table);
-	logtail.push_back(cpy_lr);
-      } else { //type is ordinary log record
-	LogRecord * cpy_lr = new LogRecord(lsn, prevLSN, txid, type);
-	logtail.push_back(cpy_lr);
-      }
-    }
+    //records are plain bytes, copying the logtail copies them all
+    logtail = rhs.logtail;
+    logtail.setDrain([this]{ flushLogTail(numeric_limits<int>::max()); });
     se = rhs.se;
+    for(map<string, LogReader*>::iterator it = readers.begin(); it != readers.end(); ++it) delete it->second;
+    readers.clear();
     tx_table = rhs.tx_table;
+    tx_first_lsn = rhs.tx_first_lsn;
     dirty_page_table = rhs.dirty_page_table;
     return *this;
     
@@ -0,0 +1,279 @@
+#include "LogReader.h"
+#include "LogCodec.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+LogReader::LogReader(string log_filename) :
+  filename(log_filename), fd(-1), sniffed(false), binary(false), framed(false), indexed_to(0),
+  cached_frame(-1) {}
+
+LogReader::~LogReader() {
+  if (fd != -1)
+    close(fd);
+}
+
+bool LogReader::openFile() {
+  if (fd == -1)
+    fd = open(filename.c_str(), O_RDONLY);
+  return fd != -1;
+}
+
+/*
+ * Decides between text and binary once the file is long enough
+ * to hold the binary file header.
+ */
+bool LogReader::sniffFormat() {
+  if (sniffed)
+    return true;
+  char magic[LOG_FILE_HEADER_SIZE];
+  ssize_t n = pread(fd, magic, sizeof(magic), 0);
+  if (n <= 0)
+    return false;
+  //a binary log whose header is not all there yet
+  size_t prefix = min((size_t)n, sizeof(LOG_FILE_MAGIC));
+  if (n < (ssize_t)sizeof(magic) && memcmp(magic, LOG_FILE_MAGIC, prefix) == 0)
+    return false;
+  sniffed = true;
+  binary = isBinaryLog(magic, n);
+  framed = isFramedLog(magic, n);
+  if (binary)
+    indexed_to = LOG_FILE_HEADER_SIZE;
+  return true;
+}
+
+/*
+ * Indexes every complete line written after indexed_to.
+ */
+void LogReader::extendIndex() {
+  if (!openFile() || !sniffFormat())
+    return;
+  if (binary) {
+    extendBinaryIndex();
+    return;
+  }
+  char buf[65536];
+  string partial; //start of a line that crosses a read boundary
+  off_t line_start = indexed_to;
+  off_t pos = indexed_to;
+  while (true) {
+    ssize_t n = pread(fd, buf, sizeof(buf), pos);
+    if (n <= 0)
+      break;
+    for (ssize_t i = 0; i < n; ++i) {
+      if (buf[i] != '\n') {
+	if (partial.length() < 16)
+	  partial += buf[i];
+	continue;
+      }
+      if (!partial.empty()) {
+	int lsn = atoi(partial.c_str());
+	lsn_pos.insert(make_pair(lsn, offsets.size()));
+	offsets.push_back(line_start);
+      }
+      partial.clear();
+      line_start = pos + i + 1;
+    }
+    pos += n;
+  }
+  //an unterminated last line is picked up by the next scan
+  indexed_to = line_start;
+}
+
+/*
+ * Indexes every complete binary record written after indexed_to.
+ * Only the fixed headers are read; the length field leads to the next one.
+ */
+void LogReader::extendBinaryIndex() {
+  if (framed) {
+    extendFrameIndex();
+    return;
+  }
+  BinaryLogHeader h;
+  while (pread(fd, &h, sizeof(h), indexed_to) == (ssize_t)sizeof(h)) {
+    if (h.length < sizeof(h))
+      break;
+    //a record still being written is picked up by the next scan
+    char last;
+    if (pread(fd, &last, 1, indexed_to + h.length - 1) != 1)
+      break;
+    lsn_pos.insert(make_pair(h.lsn, offsets.size()));
+    offsets.push_back(indexed_to);
+    indexed_to += h.length;
+  }
+}
+
+/*
+ * Reads the frame at and unpacks its records. length is set to the
+ * size of the frame on disk.
+ */
+bool LogReader::readFrame(off_t at, size_t& length, string& records) {
+  LogFrameHeader h;
+  struct stat st;
+  if (pread(fd, &h, sizeof(h), at) != (ssize_t)sizeof(h) || fstat(fd, &st) == -1 ||
+      h.packed_length > st.st_size - at - sizeof(h))
+    return false;
+  length = sizeof(h) + h.packed_length;
+  vector<char> frame(length);
+  records.clear();
+  return pread(fd, frame.data(), length, at) == (ssize_t)length &&
+    parseFrame(frame.data(), length, h) && unpackFrame(frame.data(), h, records);
+}
+
+/*
+ * Indexes the records of every complete frame written after indexed_to.
+ */
+void LogReader::extendFrameIndex() {
+  size_t length;
+  string records;
+  //a frame still being written is picked up by the next scan
+  while (readFrame(indexed_to, length, records)) {
+    frame_records.swap(records);
+    cached_frame = frames.size();
+    frames.push_back(indexed_to);
+    LogRecordView view;
+    for (size_t pos = 0; view.parse(frame_records.data() + pos, frame_records.size() - pos);
+	 pos += view.length()) {
+      lsn_pos.insert(make_pair(view.getLSN(), offsets.size()));
+      offsets.push_back((off_t)cached_frame << 32 | pos);
+    }
+    indexed_to += length;
+  }
+}
+
+bool LogReader::find(int lsn, size_t& pos) {
+  unordered_map<int, size_t>::iterator it = lsn_pos.find(lsn);
+  if (it == lsn_pos.end()) {
+    extendIndex();
+    it = lsn_pos.find(lsn);
+    if (it == lsn_pos.end())
+      return false;
+  }
+  pos = it->second;
+  return true;
+}
+
+/*
+ * Appends the binary record at offset to out.
+ */
+bool LogReader::fetch(off_t offset, string& out) {
+  LogRecordView view;
+  if (framed) {
+    size_t frame = offset >> 32;
+    size_t pos = offset & 0xffffffff;
+    if (frame != cached_frame) {
+      size_t length;
+      string records;
+      if (!readFrame(frames[frame], length, records))
+	return false;
+      frame_records.swap(records);
+      cached_frame = frame;
+    }
+    if (!view.parse(frame_records.data() + pos, frame_records.size() - pos))
+      return false;
+    out.append(view.data(), view.length());
+    return true;
+  }
+  BinaryLogHeader h;
+  if (pread(fd, &h, sizeof(h), offset) != (ssize_t)sizeof(h))
+    return false;
+  size_t start = out.size();
+  out.resize(start + h.length);
+  if (pread(fd, &out[start], h.length, offset) != (ssize_t)h.length ||
+      !view.parse(&out[start], h.length)) {
+    out.resize(start);
+    return false;
+  }
+  return true;
+}
+
+LogRecord* LogReader::readBinaryAt(off_t offset) {
+  string rec;
+  if (!fetch(offset, rec))
+    return NULL;
+  return decodeRecord(LogRecordView(rec.data()));
+}
+
+bool LogReader::readEncoded(int lsn, string& out) {
+  size_t pos;
+  if (!find(lsn, pos))
+    return false;
+  if (!binary) {
+    LogRecord* lr = readAt(offsets[pos]);
+    if (!lr)
+      return false;
+    encodeRecord(lr, out);
+    delete lr;
+    return true;
+  }
+  return fetch(offsets[pos], out);
+}
+
+LogRecord* LogReader::readAt(off_t offset) {
+  if (binary)
+    return readBinaryAt(offset);
+  string line;
+  char buf[256];
+  while (true) {
+    ssize_t n = pread(fd, buf, sizeof(buf), offset);
+    if (n <= 0)
+      break;
+    ssize_t i = 0;
+    while (i < n && buf[i] != '\n')
+      ++i;
+    line.append(buf, i);
+    if (i < n)
+      break;
+    offset += n;
+  }
+  return LogRecord::stringToRecordPtr(line);
+}
+
+LogRecord* LogReader::read(int lsn) {
+  size_t pos;
+  if (!find(lsn, pos))
+    return NULL;
+  return readAt(offsets[pos]);
+}
+
+LogReader::ForwardIterator LogReader::from(int lsn) {
+  size_t pos;
+  if (!find(lsn, pos))
+    pos = offsets.size();
+  return ForwardIterator(this, pos);
+}
+
+LogReader::ForwardIterator::ForwardIterator(LogReader* r, size_t p) :
+  reader(r), pos(p), record(NULL) {
+  if (pos < reader->offsets.size())
+    record = reader->readAt(reader->offsets[pos]);
+}
+
+void LogReader::ForwardIterator::next() {
+  delete record;
+  record = NULL;
+  ++pos;
+  if (pos >= reader->offsets.size())
+    reader->extendIndex();
+  if (pos < reader->offsets.size())
+    record = reader->readAt(reader->offsets[pos]);
+}
+
+LogReader::ChainIterator::ChainIterator(LogReader* r, int lsn) :
+  reader(r), record(r->read(lsn)) {
+  valid_record = record != NULL;
+  prev_lsn = valid_record ? record->getprevLSN() : -1;
+}
+
+void LogReader::ChainIterator::next() {
+  delete record;
+  //-1 is NULL_LSN
+  record = prev_lsn == -1 ? NULL : reader->read(prev_lsn);
+  valid_record = record != NULL;
+  prev_lsn = valid_record ? record->getprevLSN() : -1;
+}
@@ -0,0 +1,125 @@
+#ifndef LOGREADER_H_
+#define LOGREADER_H_
+
+#include "LogRecord.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/types.h>
+
+///////////////////  LogReader  ///////////////////
+
+/*
+ * Random access to the log file on disk by LSN.
+ * The LSN -> byte offset index is built lazily: a lookup that misses
+ * scans only the part of the file written since the last scan, so
+ * records are never parsed just to find another one.
+ * Reads both the text log and the binary format of LogCodec.h;
+ * a binary log is indexed from the record lengths alone. In a
+ * compressed log each frame is unpacked once to index it, and the
+ * last frame read from is kept unpacked.
+ * If an LSN repeats (runs appended to the same file), the first
+ * record with it is the one found, like a linear scan would.
+ */
+class LogReader {
+ public:
+  LogReader(std::string log_filename);
+  ~LogReader();
+
+  /*
+   * Returns the record with this LSN, or NULL if it is not on disk.
+   * The caller owns the record.
+   */
+  LogRecord* read(int lsn);
+
+  /*
+   * Appends the record with this LSN to out in the binary format of
+   * LogCodec.h: as it is on disk for a binary log, encoded for a text
+   * log. Returns false if it is not on disk. Unlike read, this works
+   * for delta records too.
+   */
+  bool readEncoded(int lsn, std::string& out);
+
+  /*
+   * Walks the log in file order, starting at a given LSN.
+   */
+  class ForwardIterator {
+   public:
+    bool valid() {return pos < reader->offsets.size();}
+    LogRecord* get() {return record;} //owned by the iterator
+    LogRecord* release() {LogRecord* r = record; record = NULL; return r;}
+    void next();
+    ForwardIterator(ForwardIterator&& o) : reader(o.reader), pos(o.pos), record(o.record) {
+      o.record = NULL;
+    }
+    ~ForwardIterator() {delete record;}
+   private:
+    friend class LogReader;
+    ForwardIterator(LogReader* r, size_t pos);
+    LogReader* reader;
+    size_t pos; //index into reader->offsets
+    LogRecord* record;
+    ForwardIterator& operator=(const ForwardIterator&);
+  };
+
+  /*
+   * Walks one transaction backwards, from a given LSN through the
+   * prevLSN of each record until it reaches NULL_LSN.
+   */
+  class ChainIterator {
+   public:
+    bool valid() {return valid_record;}
+    LogRecord* get() {return record;} //owned by the iterator
+    LogRecord* release() {LogRecord* r = record; record = NULL; return r;}
+    void next();
+    ChainIterator(ChainIterator&& o) :
+      reader(o.reader), record(o.record), valid_record(o.valid_record), prev_lsn(o.prev_lsn) {
+      o.record = NULL;
+    }
+    ~ChainIterator() {delete record;}
+   private:
+    friend class LogReader;
+    ChainIterator(LogReader* r, int lsn);
+    LogReader* reader;
+    LogRecord* record;
+    bool valid_record;
+    int prev_lsn;
+    ChainIterator& operator=(const ChainIterator&);
+  };
+
+  ForwardIterator from(int lsn);
+  ChainIterator chain(int lsn) {return ChainIterator(this, lsn);}
+
+ private:
+  std::string filename;
+  int fd;
+  bool sniffed; //format of the file known
+  bool binary;
+  bool framed; //a compressed binary log
+  off_t indexed_to; //bytes of the file already in the index
+  std::unordered_map<int, size_t> lsn_pos; //LSN -> index into offsets
+  //start of every record, in file order; in a framed log the frame
+  //number << 32 | the offset in the unpacked frame
+  std::vector<off_t> offsets;
+  std::vector<off_t> frames; //start of every frame
+  size_t cached_frame; //the one in frame_records
+  std::string frame_records;
+
+  bool openFile();
+  bool sniffFormat();
+  void extendIndex();
+  void extendBinaryIndex();
+  void extendFrameIndex();
+  bool readFrame(off_t at, size_t& length, std::string& records);
+  bool find(int lsn, size_t& pos);
+  bool fetch(off_t offset, std::string& out);
+  LogRecord* readAt(off_t offset);
+  LogRecord* readBinaryAt(off_t offset);
+
+  LogReader(const LogReader&);
+  LogReader& operator=(const LogReader&);
+};
+
+/////////////////// End LogReader  ///////////////////
+
+#endif
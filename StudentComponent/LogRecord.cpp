@@ -32,16 +32,18 @@ LogRecord* LogRecord::stringToRecordPtr(string rec_string){
     map<int, int> dirtypagemap;
     string curly;
     ss >> curly;
-    //parse the tx table map
+    //parse the tx table map ("{}" when it is empty)
     string txmapstr;
-    getline(ss, txmapstr, '}');
+    if (curly != "{}")
+      getline(ss, txmapstr, '}');
     stringstream ss2(txmapstr);
     string item;
     while (getline(ss2, item, ']')) {
       stringstream ss3(item);
       string square, status_str;
       int tx_int, lastLSN;
-      ss3 >> square >> tx_int >> lastLSN >> status_str;
+      if (!(ss3 >> square >> tx_int >> lastLSN >> status_str))
+	continue;
       TxStatus status;
       if (status_str == "U")
 	status = U;
@@ -53,14 +55,16 @@ LogRecord* LogRecord::stringToRecordPtr(string rec_string){
     ss >> curly;
     //parse the dirty page table map
     string dpmapstr;
-    getline(ss, dpmapstr, '}');
+    if (curly != "{}")
+      getline(ss, dpmapstr, '}');
     stringstream ss4(dpmapstr);
     string item2;
     while (getline(ss4, item2, ']')) {
       stringstream ss3(item2);
       string square;
       int i, j;
-      ss3 >> square >> i >> j;
+      if (!(ss3 >> square >> i >> j))
+	continue;
       dirtypagemap.insert(pair<int, int>(i,j));
     }
     ChkptLogRecord* chlr = new ChkptLogRecord(lsn, prevLSN, txID, 
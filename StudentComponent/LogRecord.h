@@ -1,3 +1,6 @@
+#ifndef LOGRECORD_H_
+#define LOGRECORD_H_
+
 #include <string>
 #include <map>
 
@@ -62,8 +65,8 @@ class UpdateLogRecord : public LogRecord{
 
   int getPageID() {return pid;}
   int getOffset() {return offset;}
-  string getBeforeImage() {return beforeImage;}
-  string getAfterImage() {return afterImage;}
+  const string& getBeforeImage() {return beforeImage;}
+  const string& getAfterImage() {return afterImage;}
 
   virtual string toString();
 
@@ -89,7 +92,7 @@ class CompensationLogRecord : public LogRecord{
 
   int getPageID() {return pageID;}
   int getOffset() {return offset;}
-  string getAfterImage() {return afterImage;}
+  const string& getAfterImage() {return afterImage;}
   int getUndoNextLSN() {return undoNextLSN;}
  private: 
   int pageID;
@@ -111,8 +114,8 @@ class ChkptLogRecord : public LogRecord{
     dirtyPageTable(dirty_page_table)
     {}
 
-  map <int,txTableEntry> getTxTable() {return txTable;}
-  map <int,int> getDirtyPageTable() {return dirtyPageTable;}
+  const map <int,txTableEntry>& getTxTable() {return txTable;}
+  const map <int,int>& getDirtyPageTable() {return dirtyPageTable;}
   virtual string toString();
  private:
   map <int,txTableEntry> txTable;
@@ -124,3 +127,5 @@ class ChkptLogRecord : public LogRecord{
 
 
 ///////////////////  End ChkptLogRecord  ///////////////////
+
+#endif
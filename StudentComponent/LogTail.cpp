@@ -0,0 +1,64 @@
+#include "LogTail.h"
+#include "LogCodec.h"
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+using namespace std;
+
+LogTail::LogTail(size_t capacity) :
+  cap(capacity), buf(new char[2 * capacity]),
+  head_pos(0), committed_pos(0), reserved_pos(0) {}
+
+LogTail::~LogTail() {
+  delete[] buf;
+}
+
+/*
+ * Copies the live records of rhs; neither tail may have writers
+ * in flight. Positions restart at 0.
+ */
+LogTail& LogTail::operator=(const LogTail& rhs) {
+  if (this == &rhs)
+    return *this;
+  if (cap != rhs.cap) {
+    delete[] buf;
+    cap = rhs.cap;
+    buf = new char[2 * cap];
+  }
+  uint64_t end = 0;
+  for (uint64_t pos = rhs.head(); pos < rhs.committed(); ) {
+    size_t len = LogRecordView(rhs.at(pos)).length();
+    memcpy(buf + end, rhs.at(pos), len);
+    end += len;
+    pos += len;
+  }
+  head_pos.store(0);
+  committed_pos.store(end);
+  reserved_pos.store(end);
+  return *this;
+}
+
+uint64_t LogTail::reserve(size_t len) {
+  if (len > cap)
+    throw length_error("LogTail: record larger than the ring");
+  uint64_t start = reserved_pos.fetch_add(len);
+  uint64_t end = start + len;
+  //backpressure: wait until the flusher has made room
+  while (end - head() > cap) {
+    if (drain)
+      drain();
+    if (end - head() > cap)
+      this_thread::yield();
+  }
+  return start;
+}
+
+void LogTail::publish(uint64_t start, const char* rec, size_t len) {
+  uint64_t end = start + len;
+  memcpy(at(start), rec, len);
+  //publish in reservation order so committed never skips a hole
+  while (committed_pos.load(memory_order_acquire) != start)
+    this_thread::yield();
+  committed_pos.store(end, memory_order_release);
+}
@@ -0,0 +1,93 @@
+#ifndef LOGTAIL_H_
+#define LOGTAIL_H_
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <stdint.h>
+
+///////////////////  LogTail  ///////////////////
+
+/*
+ * The records LogMgr has not forced yet, in a ring of fixed capacity.
+ *
+ * Positions are byte counts since the tail was created and only grow:
+ *
+ *   head        first byte not yet flushed
+ *   committed   end of the records that are completely copied in
+ *   reserved    end of the space handed out to writers
+ *
+ * A writer reserves space with one fetch_add on reserved, copies its
+ * record and then publishes it by moving committed past it, in
+ * reservation order. The flusher reads [head, committed) and truncates
+ * by storing a new head; nothing is erased or moved.
+ *
+ * The buffer is twice the capacity, so a record that starts near the
+ * end of the ring runs on past it instead of wrapping and every record
+ * is contiguous in memory. At most capacity bytes are ever live, which
+ * keeps the overflowing record clear of the ones after it.
+ */
+class LogTail {
+ public:
+  explicit LogTail(size_t capacity = 1 << 20);
+  ~LogTail();
+
+  LogTail& operator=(const LogTail& rhs);
+
+  /*
+   * Reserves len bytes (at most capacity()) and returns their position.
+   * Each record needs a reservation of its own: at() finds a record
+   * from its position, which only works where a reservation starts.
+   * While the ring is too full to take them the writer is held back:
+   * it calls the drain function if there is one, otherwise it waits
+   * for another thread to release space.
+   */
+  uint64_t reserve(size_t len);
+
+  /*
+   * Copies the record into the space reserved at start and makes it
+   * visible to the flusher once every earlier reservation is.
+   */
+  void publish(uint64_t start, const char* rec, size_t len);
+
+  /*
+   * reserve followed by publish.
+   */
+  void append(const char* rec, size_t len) {publish(reserve(len), rec, len);}
+
+  /*
+   * Called by a writer that finds the ring full; expected to flush
+   * and release whatever has been committed.
+   */
+  void setDrain(std::function<void()> drain_fn) {drain = drain_fn;}
+
+  uint64_t head() const {return head_pos.load(std::memory_order_acquire);}
+  uint64_t committed() const {return committed_pos.load(std::memory_order_acquire);}
+  uint64_t reserved() const {return reserved_pos.load(std::memory_order_acquire);}
+  bool empty() const {return head() == committed();}
+  size_t capacity() const {return cap;}
+
+  /*
+   * The record starting at position pos, which lies in [head, committed).
+   */
+  char* at(uint64_t pos) const {return buf + pos % cap;}
+
+  /*
+   * Frees everything before pos; called once a flush is on disk.
+   */
+  void release(uint64_t pos) {head_pos.store(pos, std::memory_order_release);}
+
+ private:
+  size_t cap;
+  char* buf;
+  std::atomic<uint64_t> head_pos;
+  std::atomic<uint64_t> committed_pos;
+  std::atomic<uint64_t> reserved_pos;
+  std::function<void()> drain;
+
+  LogTail(const LogTail&);
+};
+
+/////////////////// End LogTail  ///////////////////
+
+#endif
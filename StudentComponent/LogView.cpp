@@ -0,0 +1,32 @@
+#include "LogView.h"
+#include <algorithm>
+
+using namespace std;
+
+LogView::LogView(string&& log_records, size_t start) :
+  bytes(std::move(log_records)), base(0) {
+  //stops at the first record that is cut off
+  LogRecordView rec;
+  for (size_t pos = start; pos + sizeof(BinaryLogHeader) <= bytes.size(); pos += rec.length()) {
+    rec = LogRecordView(bytes.data() + pos);
+    if (rec.length() < sizeof(BinaryLogHeader) || pos + rec.length() > bytes.size())
+      break;
+    offsets.push_back(pos);
+  }
+  if (offsets.empty())
+    return;
+  int lo = (*this)[0].getLSN();
+  int hi = lo;
+  for (unsigned i = 1; i < offsets.size(); ++i) {
+    lo = min(lo, (*this)[i].getLSN());
+    hi = max(hi, (*this)[i].getLSN());
+  }
+  base = lo;
+  index.assign(hi - lo + 1, -1);
+  for (unsigned i = 0; i < offsets.size(); ++i) {
+    //keep the first record if an LSN repeats, like a linear scan would
+    int lsn = (*this)[i].getLSN();
+    if (index[lsn - base] == -1)
+      index[lsn - base] = i;
+  }
+}
@@ -0,0 +1,59 @@
+#ifndef LOGVIEW_H_
+#define LOGVIEW_H_
+
+#include "LogCodec.h"
+#include <string>
+#include <vector>
+
+///////////////////  LogView  ///////////////////
+
+/*
+ * A run of log records in log order, indexed by LSN.
+ * The records sit back to back in one buffer in the binary format of
+ * LogCodec.h and are read in place through LogRecordView, so walking
+ * the log allocates nothing per record.
+ * LSNs are handed out consecutively, so the index is a dense array
+ * of positions starting at the smallest LSN; lookups are O(1).
+ */
+class LogView {
+ public:
+  /*
+   * Takes over the buffer; records start at byte start.
+   */
+  LogView(std::string&& log_records, size_t start = 0);
+
+  size_t size() const {return offsets.size();}
+  LogRecordView operator[](size_t pos) const {
+    return LogRecordView(bytes.data() + offsets[pos]);
+  }
+
+  /*
+   * Position of the record with this LSN, -1 if it is not in the view.
+   */
+  int position(int lsn) const {
+    if (lsn < base || lsn - base >= (int)index.size())
+      return -1;
+    return index[lsn - base];
+  }
+
+  /*
+   * The record with this LSN, an invalid view if it is not in the view.
+   */
+  LogRecordView find(int lsn) const {
+    int pos = position(lsn);
+    return pos == -1 ? LogRecordView() : (*this)[pos];
+  }
+
+ private:
+  std::string bytes;
+  std::vector<size_t> offsets; //start of every record in bytes
+  std::vector<int> index; //LSN - base -> position, -1 for LSNs not logged
+  int base;
+
+  LogView(const LogView&);
+  LogView& operator=(const LogView&);
+};
+
+/////////////////// End LogView  ///////////////////
+
+#endif